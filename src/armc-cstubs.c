@@ -65,6 +65,10 @@ extern int errno;
 /* Prototype for the UART write function */
 #include "rpi-aux.h"
 
+/* For HAS_MULTICORE and _get_core() */
+#include "tube-defs.h"
+#include "startup.h"
+
 /* A pointer to a list of environment variables and their values. For a minimal
  environment, this empty list is adequate: */
 char *__env[1] =
@@ -187,6 +191,36 @@ caddr_t _sbrk(int incr)
   return (caddr_t) prev_heap_end;
 }
 
+#ifdef HAS_MULTICORE
+
+/* The VDU core also allocates memory, so malloc must be locked across cores.
+ The lock is recursive, as newlib may call __malloc_lock more than once. */
+struct _reent;
+
+static volatile int malloc_lock_owner = -1;
+static int malloc_lock_count = 0;
+
+void __malloc_lock(struct _reent *r)
+{
+  int core = (int) _get_core();
+  if (malloc_lock_owner != core) {
+    int expected;
+    do {
+      expected = -1;
+    } while (!__atomic_compare_exchange_n(&malloc_lock_owner, &expected, core, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+  }
+  malloc_lock_count++;
+}
+
+void __malloc_unlock(struct _reent *r)
+{
+  if (--malloc_lock_count == 0) {
+    __atomic_store_n(&malloc_lock_owner, -1, __ATOMIC_RELEASE);
+  }
+}
+
+#endif
+
 /* Status of a file (by name). Minimal implementation: */
 int stat(const char *file, struct stat *st)
 {
@@ -47,7 +47,7 @@ static const unsigned int shareable = 1u;
 // The origin of this function is:
 // https://github.com/rsta2/uspi/blob/master/env/lib/synchronize.c
 
-void InvalidateDataCache (void)
+static void InvalidateL1DataCache (void)
 {
    unsigned nSet;
    unsigned nWay;
@@ -61,6 +61,15 @@ void InvalidateDataCache (void)
          asm volatile ("mcr p15, 0, %0, c7, c6,  2" : : "r" (nSetWayLevel) : "memory");   // DCISW
       }
    }
+}
+
+void InvalidateDataCache (void)
+{
+   unsigned nSet;
+   unsigned nWay;
+   uint32_t nSetWayLevel;
+   // invalidate L1 data cache
+   InvalidateL1DataCache();
 
    // invalidate L2 unified cache
    for (nSet = 0; nSet < L2_CACHE_SETS; nSet++) {
@@ -198,6 +207,8 @@ void map_4k_pageJIT(unsigned int logical, unsigned int physical) {
   _invalidate_tlb_mva((void *)(logical << 12));
 }
 
+static void enable_MMU(int secondary);
+
 void enable_MMU_and_IDCaches(void)
 {
   LOG_DEBUG("enable_MMU_and_IDCaches\r\n");
@@ -286,6 +297,12 @@ void enable_MMU_and_IDCaches(void)
   for (base = 0; base < 256; base++)
     map_4k_pageJIT_quick((JITTEDTABLE16>>12)+base, (JITTEDTABLE16>>12)+base);
 
+  enable_MMU(0);
+}
+
+// Program this core's MMU to use the page tables, and enable the caches
+static void enable_MMU(int secondary)
+{
 #if defined(RPI3)||defined(RPI4)
   //unsigned cpuextctrl0, cpuextctrl1;
   //asm volatile ("mrrc p15, 1, %0, %1, c15" : "=r" (cpuextctrl0), "=r" (cpuextctrl1));
@@ -331,8 +348,14 @@ void enable_MMU_and_IDCaches(void)
   // Invalidate entire data cache
 #if defined(RPI2) || defined(RPI3) || defined(RPI4)
   asm volatile ("isb" ::: "memory");
-  InvalidateDataCache();
+  if (secondary) {
+    // The L2 cache is shared, and in use by core 0
+    InvalidateL1DataCache();
+  } else {
+    InvalidateDataCache();
+  }
 #else
+  (void) secondary;
   // invalidate data cache and flush prefetch buffer
   // NOTE: The below code seems to cause a Pi 2 to crash
   asm volatile ("mcr p15, 0, %0, c7, c5,  4" :: "r" (0) : "memory");
@@ -362,3 +385,13 @@ void enable_MMU_and_IDCaches(void)
   //asm volatile ("mrc p15,0,%0,c0,c0,1" : "=r" (ctype));
   //LOG_DEBUG("ctype   = %08x\r\n", ctype);
 }
+
+#if defined(RPI2) || defined(RPI3) || defined(RPI4)
+
+// Used by the secondary cores, which share the page tables created by core 0
+void enable_MMU_and_IDCaches_secondary(void)
+{
+  enable_MMU(1);
+}
+
+#endif
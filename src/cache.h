@@ -17,6 +17,7 @@ void map_4k_page(unsigned int logical, unsigned int physical);
 void map_4k_pageJIT(unsigned int logical, unsigned int physical);
 
 void enable_MMU_and_IDCaches(void);
+void enable_MMU_and_IDCaches_secondary(void);
 
 void _clean_cache_area(void * start, unsigned int length);
 void _invalidate_cache_area(void * start, unsigned int length);
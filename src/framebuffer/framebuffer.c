@@ -10,6 +10,7 @@
 #include "../rpi-aux.h"
 #include "../rpi-gpio.h"
 #include "../rpi-interrupts.h"
+#include "../rpi-systimer.h"
 #include "../startup.h"
 #include "../tube.h"
 #include "../copro-defs.h"
@@ -19,6 +20,7 @@
 #include "framebuffer.h"
 #include "primitives.h"
 #include "fonts.h"
+#include "teletext.h"
 
 // Current screen mode
 static screen_mode_t *screen = NULL;
@@ -99,12 +101,55 @@ static volatile int vsync_flag = 0;
 static volatile uint8_t flash_mark_time  = 25;
 static volatile uint8_t flash_space_time = 25;
 
+// Set by VDU 23,20,2 to copy the off-screen buffer to the display on the next vsync
+static volatile int flip_pending = 0;
+
 // VDU Queue
-#define VDU_QSIZE 8192
+//
+// This is a single-producer/single-consumer ring: vdu_wp is only written by
+// the producer, and vdu_rp only by the consumer. On multicore builds the
+// consumer is the VDU core, so barriers are needed to order the data with
+// respect to the pointers.
+//
+// Queued characters are never overwritten. The parasite (&FEF8 writes and
+// OS_WriteC) is held off once the queue passes the high-water mark, which
+// leaves the rest of the queue for the host (copro_command 3), as its writes
+// arrive in FIQ context and can't be deferred.
+#define VDU_QSIZE 16384
+#define VDU_QHIGH (VDU_QSIZE / 2)
+// Maximum characters rendered before their slots are released to the producers
+#define VDU_QBATCH 256
+#define VDU_QDEPTH() ((vdu_wp - vdu_rp) & (VDU_QSIZE - 1))
 static volatile unsigned int vdu_wp = 0;
 static volatile unsigned int vdu_rp = 0;
 static uint8_t vdu_queue[VDU_QSIZE];
 
+// Set while the consumer is rendering characters from the queue, so VDU
+// handlers that print (e.g. VDU 23,19,128 reporting a font name) write directly
+static volatile int vdu_draining = 0;
+
+// Queue statistics (reported by *PIVDUQ)
+static volatile unsigned int vdu_peak_depth = 0;
+static volatile unsigned int vdu_stall_count = 0;
+static volatile unsigned int vdu_stall_time = 0;
+static volatile unsigned int vdu_overflow_count = 0;
+
+#ifdef HAS_MULTICORE
+#define VDU_QUEUE_BARRIER() _data_memory_barrier()
+// Set once the VDU core has taken over rendering from the main core
+static volatile int vdu_core_running = 0;
+// Incremented by the vsync interrupt, and polled by the VDU core
+static volatile unsigned int vsync_count = 0;
+// The core the VDU core is running on (only valid once vdu_core_running is set)
+static unsigned int vdu_core;
+// A function the VDU core is asked to run for the main core (e.g. reading the
+// screen, which mustn't race with the flashing cursor), cleared once it's done
+static void (*volatile vdu_request)(void *arg) = NULL;
+static void *volatile vdu_request_arg;
+#else
+#define VDU_QUEUE_BARRIER()
+#endif
+
 #define VDU_BUF_LEN 16
 
 typedef struct {
@@ -190,6 +235,7 @@ static void update_g_cursors(int16_t x, int16_t y);
 static void change_mode(screen_mode_t *new_screen);
 static void set_graphics_area(screen_mode_t *scr, g_clip_window_t *window);
 static int read_character(int x_pos, int y_pos);
+static void sync_vdu_queue();
 
 // These are used in VDU 4 mode
 static void text_cursor_left();
@@ -700,6 +746,15 @@ static void text_delete() {
 //    g_window.left/max are also in absolute external coordinates
 //    font_width/height are in screen pixels
 
+// Teletext only redraws cells whose attributes have changed, so anything
+// else drawing into a teletext mode (CLG, PLOT, VDU 5 text) must first make
+// it forget what it last drew
+static void graphics_drawn() {
+   if (screen->mode_flags & F_TELETEXT) {
+      tt_invalidate_cache();
+   }
+}
+
 static void graphics_cursor_left() {
    g_x_pos -= (int16_t)(font_width << screen->xeigfactor);
    if (g_x_pos < g_window.left) {
@@ -759,11 +814,13 @@ static void graphics_cursor_tab(uint8_t *buf) {
 static void graphics_area_clear() {
    g_x_pos = g_window.left;
    g_y_pos = g_window.top;
+   graphics_drawn();
    prim_clear_graphics_area(screen);
 }
 
 static void graphics_delete() {
    graphics_cursor_left();
+   graphics_drawn();
    int x = g_x_pos >> screen->xeigfactor;
    int y = g_y_pos >> screen->yeigfactor;
    prim_fill_rectangle(screen, x, y, x + (font_width - 1), y - (font_height - 1), PC_BG);
@@ -1018,6 +1075,22 @@ static void vdu23_19(uint8_t *buf) {
    update_text_area();
 }
 
+static void vdu23_20(const uint8_t *buf) {
+   // VDU 23,20,0,0,0,0,0,0,0,0 - draw directly to the display (default)
+   // VDU 23,20,1,0,0,0,0,0,0,0 - draw to an off-screen buffer (double buffering)
+   // VDU 23,20,2,0,0,0,0,0,0,0 - copy the dirty regions to the display on the next vsync
+   switch (buf[1]) {
+   case 0:
+   case 1:
+      flip_pending = 0;
+      set_double_buffer(screen, buf[1]);
+      break;
+   case 2:
+      flip_pending = 1;
+      break;
+   }
+}
+
 static void vdu23_22(const uint8_t *buf) {
    // VDU 23,22,xpixels;ypixels;xchars,ychars,colours,flags
    // User Defined Screen Mode
@@ -1078,6 +1151,7 @@ static void vdu_5(uint8_t *buf) {
 }
 
 static void vdu_16(uint8_t *buf) {
+   graphics_drawn();
    prim_clear_graphics_area(screen);
 }
 
@@ -1195,6 +1269,7 @@ static void vdu_23(uint8_t *buf) {
       case 15: vdu23_15(buf + 1); break;
       case 17: vdu23_17(buf + 1); break;
       case 19: vdu23_19(buf + 1); break;
+      case 20: vdu23_20(buf + 1); break;
       case 22: vdu23_22(buf + 1); break;
       case 27: vdu23_27(buf + 1); break;
       default: screen->unknown_vdu(screen, buf);
@@ -1260,6 +1335,8 @@ static void vdu_25(uint8_t *buf) {
          colour = PC_INV;
       }
 
+      graphics_drawn();
+
       switch (g_mode & 0xF8) {
 
       case 0:
@@ -1432,6 +1509,7 @@ static void vdu_default(uint8_t *buf) {
       int x = g_x_pos >> screen->xeigfactor;
       int y = g_y_pos >> screen->yeigfactor;
       // Only draw the foreground pixels
+      graphics_drawn();
       prim_draw_character(screen, c, x, y, PC_FG);
       // Advance the drawing position
       graphics_cursor_right();
@@ -1535,6 +1613,9 @@ static void owl(int x0, int y0, int r, int col) {
    };
 
    // Save graphics colour
+   // (on multicore builds, the plots are drawn by the VDU core, so each direct
+   // change of the graphics colour must wait until it has caught up)
+   sync_vdu_queue();
    pixel_t old_col = prim_get_fg_col();
    plotmode_t old_mode = prim_get_fg_plotmode();
    for (unsigned int i = 0; i < sizeof(data) / sizeof(int); i++) {
@@ -1543,6 +1624,7 @@ static void owl(int x0, int y0, int r, int col) {
          int xc = x0 + x * r;
          int yc = y0 - y * r;
          int d = y / 3;
+         sync_vdu_queue();
          prim_set_fg_plotmode(screen, PM_NORMAL);
          prim_set_fg_col(screen, screen->get_colour(screen, cols[d]));
          plot(  4, xc, yc);
@@ -1552,6 +1634,7 @@ static void owl(int x0, int y0, int r, int col) {
       }
    }
    // Restore graphics colour
+   sync_vdu_queue();
    prim_set_fg_plotmode(screen, old_mode);
    prim_set_fg_col(screen, old_col);
 }
@@ -1559,6 +1642,12 @@ static void owl(int x0, int y0, int r, int col) {
 void fb_show_splash_screen() {
    char buffer[256];
 
+   // Optionally enable double buffering (vdu_double_buffer=1 in cmdline.txt)
+   char *prop = get_cmdline_prop("vdu_double_buffer");
+   if (prop && atoi(prop)) {
+      set_double_buffer(screen, 1);
+   }
+
    // Select the default screen mode
    fb_writec(22);
    fb_writec(DEFAULT_SCREEN_MODE);
@@ -1604,6 +1693,7 @@ void fb_show_splash_screen() {
    fb_writes("  CALL &300 to install OSWRCH redirector\r\n");
    fb_writes("  CALL &2000 to list available Co Pros\r\n\n");
 
+   sync_vdu_queue();
    sprintf(buffer, "This is mode %d: %dx%d with %d colours",
            screen->mode_num, screen->width, screen->height, screen->ncolour + 1);
    fb_writes(buffer);
@@ -1629,23 +1719,28 @@ void fb_initialize() {
    fb_writec(22);
    fb_writec(DEFAULT_SCREEN_MODE);
 
+#ifndef FB_HEADLESS
    // Enable the timer interrupts (flashing colours, cursor, etc)
    RPI_ArmTimerInit();
    RPI_GetIrqController()->Enable_Basic_IRQs = RPI_BASIC_ARM_TIMER_IRQ;
+#endif
 
 #ifdef DEBUG_VDU
    fb_writes("DEBUG_VDU is enabled, execution might be slow!\r\n\r\n");
 #endif
 
+#ifndef FB_HEADLESS
    // Make vsync visible
    // Enable smi_int which is IRQ 48
    // https://github.com/raspberrypi/firmware/issues/67
    RPI_GetIrqController()->Enable_IRQs_2 = RPI_VSYNC_IRQ;
+#endif
 
 }
 
 void fb_destroy() {
 
+#ifndef FB_HEADLESS
    // Disable the VSync Interrupt
    RPI_GetIrqController()->Disable_IRQs_2 = RPI_VSYNC_IRQ;
 
@@ -1656,10 +1751,12 @@ void fb_destroy() {
    RPI_PropertyInit();
    RPI_PropertyAddTag(TAG_RELEASE_BUFFER);
    RPI_PropertyProcess();
+#endif
 }
 
 void fb_custom_mode(int x_pixels, int y_pixels, unsigned int n_colours) {
    screen_mode_t *new_screen;
+   sync_vdu_queue();
    if (n_colours > 0x10000) {
       new_screen = get_screen_mode(CUSTOM_32BPP_SCREEN_MODE);
    } else if (n_colours > 0x100) {
@@ -1688,16 +1785,29 @@ void fb_custom_mode(int x_pixels, int y_pixels, unsigned int n_colours) {
 }
 
 void fb_writec_buffered(char c) {
-   // TODO: Deal with overflow
+   unsigned int depth = VDU_QDEPTH();
+   if (depth == VDU_QSIZE - 1) {
+      // The queue is full, so the character is dropped rather than
+      // overwriting earlier ones. This can only happen if the host
+      // outruns the consumer by the space above the high-water mark.
+      vdu_overflow_count++;
+      return;
+   }
    vdu_queue[vdu_wp] = c;
+   // Make sure the character is visible before the write pointer
+   VDU_QUEUE_BARRIER();
    vdu_wp = (vdu_wp + 1) & (VDU_QSIZE - 1);
+   if (depth >= vdu_peak_depth) {
+      vdu_peak_depth = depth + 1;
+   }
 }
 
-static void writec(char ch) {
+// State of the VDU command currently being assembled by writec
+static int vdu_index = 0;
+static vdu_operation_t *vdu_op = NULL;
+static uint8_t vdu_buf[VDU_BUF_LEN];
 
-   static int vdu_index = 0;
-   static vdu_operation_t *vdu_op = NULL;
-   static uint8_t vdu_buf[VDU_BUF_LEN];
+static void writec(char ch) {
 
    uint8_t c = (uint8_t) ch;
 
@@ -1718,45 +1828,201 @@ static void writec(char ch) {
    }
 }
 
+static inline int is_printable(uint8_t c) {
+   return vdu_operation_table[c].handler == vdu_default;
+}
+
+// Write a run of printable characters, equivalent to passing each to vdu_default,
+// but with the cursors removed and redrawn once for the whole run, and the
+// wrap/scroll decision only made at the end of each line
+static void write_text(const uint8_t *s, unsigned int n) {
+   if (text_at_g_cursor) {
+      while (n--) {
+         vdu_default((uint8_t *)s++);
+      }
+      return;
+   }
+   int tmp = disable_cursors();
+   while (n--) {
+      screen->write_character(screen, *s++, c_x_pos, c_y_pos, c_fg_col, c_bg_col);
+      if (c_x_pos < t_window.right) {
+         c_x_pos++;
+      } else {
+         c_x_pos = t_window.left;
+         if (c_y_pos < t_window.bottom) {
+            c_y_pos++;
+         } else {
+            text_area_scroll(SCROLL_UP);
+         }
+      }
+   }
+   if (tmp) {
+      enable_cursors();
+   }
+   update_cursors();
+}
+
+static void process_vdu_queue() {
+   unsigned int rp = vdu_rp;
+   unsigned int wp;
+   vdu_draining = 1;
+   // Drain the queue in batches, sampling the write pointer and releasing
+   // the slots once per batch, rather than once per character
+   while (rp != (wp = vdu_wp)) {
+      // Make sure the characters are read after the write pointer
+      VDU_QUEUE_BARRIER();
+      unsigned int n = (wp - rp) & (VDU_QSIZE - 1);
+      if (n > VDU_QBATCH) {
+         n = VDU_QBATCH;
+      }
+      while (n) {
+         if (vdu_index == 0 && is_printable(vdu_queue[rp])) {
+            // Hand the run of printable characters (up to the end of the queue buffer) to the text writer
+            unsigned int run = 1;
+            unsigned int max = VDU_QSIZE - rp;
+            if (max > n) {
+               max = n;
+            }
+            while (run < max && is_printable(vdu_queue[rp + run])) {
+               run++;
+            }
+            write_text(vdu_queue + rp, run);
+            rp = (rp + run) & (VDU_QSIZE - 1);
+            n -= run;
+         } else {
+            writec((char) vdu_queue[rp]);
+            rp = (rp + 1) & (VDU_QSIZE - 1);
+            n--;
+         }
+      }
+      // Make sure the characters are read before the slots are released
+      VDU_QUEUE_BARRIER();
+      vdu_rp = rp;
+   }
+   vdu_draining = 0;
+}
+
+// Hold off the parasite until the queue is back below the high-water mark
+static void wait_for_vdu_queue() {
+   if (VDU_QDEPTH() < VDU_QHIGH) {
+      return;
+   }
+#ifdef FB_HEADLESS
+   // There is no consumer running in the background, so drain the queue here
+   process_vdu_queue();
+#else
+   unsigned int start = RPI_GetSystemTimer()->counter_lo;
+#ifdef HAS_MULTICORE
+   if (vdu_core_running) {
+      // The VDU core will drain the queue
+      while (VDU_QDEPTH() >= VDU_QHIGH);
+   } else
+#endif
+   if (_get_cpsr() & 0x80) {
+      // IRQs are disabled, so the timer interrupt can't drain the queue
+      process_vdu_queue();
+   } else {
+      // The timer interrupt will drain the queue
+      while (VDU_QDEPTH() >= VDU_QHIGH);
+   }
+   vdu_stall_count++;
+   vdu_stall_time += RPI_GetSystemTimer()->counter_lo - start;
+#endif
+}
+
+static void process_vsync() {
+   static uint8_t cursor_count = 0;
+   // Complete any pending double buffer flip, before waking *FX 19
+   if (flip_pending) {
+      flip_double_buffer(screen);
+      flip_pending = 0;
+   }
+   // Note the vsync interrupt
+   vsync_flag = 1;
+   // Handle the flashing cursor (toggles every 160ms / 320ms)
+   cursor_count++;
+   if (cursor_count >= (e_enabled ? 8 : 16)) {
+      cursor_interrupt();
+      cursor_count = 0;
+   }
+
+   // Handle the flashing colours
+   // - non-teletext mode, 500ms on, 500ms off
+   // - teletext mode, 320ms on 960ms off
+   // -
+   if (screen->flash) {
+      static uint8_t flash_count = 0;
+      static uint8_t flash_state = 0;
+      if (flash_mark_time == 0 || flash_space_time == 0) {
+         // An on/off time of zero is infinite and flashing stops
+         uint8_t tmp = (flash_mark_time == 0) ? 1 : 0;
+         if (tmp != flash_state) {
+            flash_state = tmp;
+            screen->flash(screen, tmp);
+            flash_count = 0;
+         }
+      } else {
+         flash_count++;
+         if (flash_count >= (flash_state ? flash_mark_time : flash_space_time)) {
+            flash_state = !flash_state;
+            screen->flash(screen, flash_state);
+            flash_count = 0;
+         }
+      }
+   }
+}
+
+// Wait until the VDU core has caught up, so the VDU state can be safely accessed
+static void sync_vdu_queue() {
+#ifdef HAS_MULTICORE
+   if (vdu_core_running) {
+      while (vdu_rp != vdu_wp);
+      // Make sure the VDU state is read after the VDU core has finished with it
+      _data_memory_barrier();
+   }
+#endif
+}
+
+// Run a function that reads the screen on the VDU core, so it can't overlap
+// with the VDU core's vsync work (flashing cursor, flashing colours, flips)
+static void run_on_vdu_core(void (*fn)(void *arg), void *arg) {
+   sync_vdu_queue();
+#ifdef HAS_MULTICORE
+   if (vdu_core_running && _get_core() != vdu_core) {
+      vdu_request_arg = arg;
+      _data_memory_barrier();
+      vdu_request = fn;
+      while (vdu_request);
+      _data_memory_barrier();
+      return;
+   }
+#endif
+   fn(arg);
+}
+
+#ifdef FB_HEADLESS
+
+void fb_process_vdu_queue() {
+   // There are no interrupts, so just service the VDU Queue
+   process_vdu_queue();
+}
+
+#else
+
 void fb_process_vdu_queue() {
    if (RPI_GetIrqController()->IRQ_pending_2 & RPI_VSYNC_IRQ) {
-      static uint8_t cursor_count = 0;
       // Clear the vsync interrupt
       _data_memory_barrier();
       *((volatile uint32_t *)SMICTRL) = 0;
       _data_memory_barrier();
-      // Note the vsync interrupt
-      vsync_flag = 1;
-      // Handle the flashing cursor (toggles every 160ms / 320ms)
-      cursor_count++;
-      if (cursor_count >= (e_enabled ? 8 : 16)) {
-         cursor_interrupt();
-         cursor_count = 0;
-      }
-
-      // Handle the flashing colours
-      // - non-teletext mode, 500ms on, 500ms off
-      // - teletext mode, 320ms on 960ms off
-      // -
-      if (screen->flash) {
-         static uint8_t flash_count = 0;
-         static uint8_t flash_state = 0;
-         if (flash_mark_time == 0 || flash_space_time == 0) {
-            // An on/off time of zero is infinite and flashing stops
-            uint8_t tmp = (flash_mark_time == 0) ? 1 : 0;
-            if (tmp != flash_state) {
-               flash_state = tmp;
-               screen->flash(screen, tmp);
-               flash_count = 0;
-            }
-         } else {
-            flash_count++;
-            if (flash_count >= (flash_state ? flash_mark_time : flash_space_time)) {
-               flash_state = !flash_state;
-               screen->flash(screen, flash_state);
-               flash_count = 0;
-            }
-         }
+#ifdef HAS_MULTICORE
+      if (vdu_core_running) {
+         // Leave the vsync work to the VDU core
+         vsync_count++;
+      } else
+#endif
+      {
+         process_vsync();
       }
    }
 
@@ -1768,31 +2034,139 @@ void fb_process_vdu_queue() {
       _data_memory_barrier();
 
       // Service the VDU Queue
-      while (vdu_rp != vdu_wp) {
-         uint8_t ch = vdu_queue[vdu_rp];
-         writec(ch);
-         vdu_rp = (vdu_rp + 1) & (VDU_QSIZE - 1);
+      process_vdu_queue();
+   }
+}
+
+#endif
+
+#ifdef HAS_MULTICORE
+
+void fb_start_vdu_core(unsigned int core) {
+   // The timer interrupt is no longer needed to service the VDU queue
+   RPI_GetIrqController()->Disable_Basic_IRQs = RPI_BASIC_ARM_TIMER_IRQ;
+   // Record the renderer core first, so fb_writec on the main core never
+   // mistakes itself for the VDU core
+   vdu_core = core;
+   _data_memory_barrier();
+   // From now on the main core only adds characters to the VDU queue
+   vdu_core_running = 1;
+}
+
+void fb_run_vdu_core() {
+   unsigned int last_vsync = vsync_count;
+   while (1) {
+      process_vdu_queue();
+      if (vdu_request) {
+         _data_memory_barrier();
+         vdu_request(vdu_request_arg);
+         _data_memory_barrier();
+         vdu_request = NULL;
+      }
+      if (vsync_count != last_vsync) {
+         last_vsync = vsync_count;
+         process_vsync();
       }
    }
 }
+
+#endif
+
 void fb_writec(char c) {
-   // Avoid re-ordering parasite and host characters
-   if (vdu_rp != vdu_wp) {
+#ifdef HAS_MULTICORE
+   if (vdu_core_running) {
+      if (_get_core() == vdu_core) {
+         // Printing from a VDU handler, which is already running on the VDU core
+         writec(c);
+         return;
+      }
+      // Wait for space, as the VDU core will drain the queue
+      wait_for_vdu_queue();
+      // The main core has a single producer, as long as the tube FIQ can't interleave
+      int cpsr = _disable_interrupts();
+      fb_writec_buffered(c);
+      _set_interrupts(cpsr);
+      return;
+   }
+#endif
+   if (vdu_draining) {
+      // Printing from a VDU handler, so bypass the characters still queued behind it
+      writec(c);
+   } else if (vdu_rp != vdu_wp) {
+      // Avoid re-ordering parasite and host characters
       // Some characters are already queued, so append to the end of the queue
+      wait_for_vdu_queue();
+#ifdef FB_HEADLESS
       fb_writec_buffered(c);
+#else
+      // The tube FIQ is the other producer, so keep it out
+      int cpsr = _disable_interrupts();
+      fb_writec_buffered(c);
+      _set_interrupts(cpsr);
+#endif
    } else {
       // Otherwise, it's safe to print directly
       writec(c);
    }
 }
 
-void fb_writes(const char *string) {
-   while (*string) {
-      fb_writec(*string++);
+void fb_get_vdu_queue_stats(vdu_queue_stats_t *stats, int reset) {
+   stats->size       = VDU_QSIZE;
+   stats->depth      = VDU_QDEPTH();
+   stats->peak_depth = vdu_peak_depth;
+   stats->stalls     = vdu_stall_count;
+   stats->stall_time = vdu_stall_time;
+   stats->overflows  = vdu_overflow_count;
+   if (reset) {
+      vdu_peak_depth     = 0;
+      vdu_stall_count    = 0;
+      vdu_stall_time     = 0;
+      vdu_overflow_count = 0;
+   }
+}
+
+void fb_writen(const char *string, unsigned int len) {
+#ifdef HAS_MULTICORE
+   if (vdu_core_running) {
+      while (len--) {
+         fb_writec(*string++);
+      }
+      return;
    }
+#endif
+   // Print directly while the queue is empty, handing runs of printable
+   // characters to the text writer as process_vdu_queue does
+   const uint8_t *s = (const uint8_t *)string;
+   while (len) {
+      if (vdu_draining || vdu_rp != vdu_wp) {
+         // Something got queued (e.g. from an interrupt), so keep the
+         // ordering rules of fb_writec for the rest of the string
+         while (len--) {
+            fb_writec((char) *s++);
+         }
+         return;
+      }
+      if (vdu_index == 0 && is_printable(*s)) {
+         unsigned int run = 1;
+         while (run < len && is_printable(s[run])) {
+            run++;
+         }
+         write_text(s, run);
+         s += run;
+         len -= run;
+      } else {
+         writec((char) *s++);
+         len--;
+      }
+   }
+}
+
+void fb_writes(const char *string) {
+   fb_writen(string, (unsigned int) strlen(string));
 }
 
 int fb_get_cursor_x() {
+   sync_vdu_queue();
    if (e_enabled) {
       return e_x_pos - t_window.left;
    } else {
@@ -1801,6 +2175,7 @@ int fb_get_cursor_x() {
 }
 
 int fb_get_cursor_y() {
+   sync_vdu_queue();
    if (e_enabled) {
       return e_y_pos - t_window.top;
    } else {
@@ -1808,16 +2183,41 @@ int fb_get_cursor_y() {
    }
 }
 
-int fb_get_cursor_char() {
+static void get_cursor_char(void *arg) {
+   int *c = (int *)arg;
    if (e_enabled) {
-      return read_character(e_x_pos, e_y_pos);
+      *c = read_character(e_x_pos, e_y_pos);
    } else {
-      return read_character(c_x_pos, c_y_pos);
+      *c = read_character(c_x_pos, c_y_pos);
    }
 }
 
+int fb_get_cursor_char() {
+   int c;
+   run_on_vdu_core(get_cursor_char, &c);
+   return c;
+}
+
 void fb_wait_for_vsync() {
 
+#ifdef FB_HEADLESS
+   // There is no display, so simulate a vsync
+   flip_pending = is_double_buffered();
+   process_vsync();
+   vsync_flag = 0;
+   return;
+#endif
+
+   // Make sure the frame is complete (and any VDU 23,20 has been seen) before flipping
+   sync_vdu_queue();
+
+   // When double buffering, *FX 19 also makes the current frame visible
+   // (clear any stale VSYNC flag, so the flip completes before we return)
+   if (is_double_buffered()) {
+      flip_pending = 1;
+      vsync_flag = 0;
+   }
+
    // Wait for the VSYNC flag to be set by the IRQ handler
    while (!vsync_flag);
 
@@ -1826,10 +2226,12 @@ void fb_wait_for_vsync() {
 }
 
 screen_mode_t *fb_get_current_screen_mode() {
+   sync_vdu_queue();
    return screen;
 }
 
 int32_t fb_read_vdu_variable(vdu_variable_t v) {
+   sync_vdu_queue();
    if (v < 0x80) {
       return fb_read_mode_variable( (mode_variable_t) v, screen);
    }
@@ -1909,7 +2311,7 @@ int32_t fb_read_vdu_variable(vdu_variable_t v) {
       return (int)(get_fb_address());
    case V_DISPLAYSTART:
       // As used by display hardware
-      return (int)(get_fb_address());
+      return (int)(get_fb_display_address());
    case V_TOTALSCREENSIZE:
       return screen->height * screen->pitch;
    case V_GPLFMD:
@@ -2013,6 +2415,7 @@ static uint8_t read_legacy_vdu_variable_helper(vdu_variable_t v, uint8_t offset)
 }
 
 uint8_t fb_read_legacy_vdu_variable(uint8_t v) {
+   sync_vdu_queue();
    // VDU Variables are unfortunately platform specific, so try to do some mapping
    //
    // Where these correspond to RISCOS VDU variables, we use them directly.
@@ -2150,49 +2553,71 @@ uint8_t fb_get_flash_space_time() {
    return flash_space_time;
 }
 
-int fb_point(int16_t x, int16_t y, pixel_t *colour) {
+typedef struct {
+   int16_t x;
+   int16_t y;
+   pixel_t colour;
+   int result;
+} point_request_t;
+
+static void point(void *arg) {
+   point_request_t *req = (point_request_t *)arg;
    // convert to absolute external coorrdinates
-   x += g_x_origin;
-   y += g_y_origin;
+   int16_t x = (int16_t)(req->x + g_x_origin);
+   int16_t y = (int16_t)(req->y + g_y_origin);
    if (x < g_window.left || x > g_window.right || y < g_window.bottom || y > g_window.top) {
       // -1 indicates pixel off screen
-      return -1;
+      req->result = -1;
    } else {
       // convert to absolute pixel coorrdinates
       x >>= screen->xeigfactor;
       y >>= screen->yeigfactor;
       // read the pixel
-      *colour = prim_get_pixel(screen, x, y);
+      req->colour = prim_get_pixel(screen, x, y);
       // 0 indicates pixel on screen
-      return 0;
+      req->result = 0;
+   }
+}
+
+int fb_point(int16_t x, int16_t y, pixel_t *colour) {
+   point_request_t req = { x, y, 0, 0 };
+   run_on_vdu_core(point, &req);
+   if (!req.result) {
+      *colour = req.colour;
    }
+   return req.result;
 }
 
 // Set the foreground graphics colour directly, bypassing the colour/tint VDU variables
 void fb_set_g_fg_col(uint8_t action, pixel_t colour) {
+   sync_vdu_queue();
    prim_set_fg_plotmode(screen, action);
    prim_set_fg_col(screen, colour);
 }
 
 // Set the background graphics colour directly, bypassing the colour/tint VDU variables
 void fb_set_g_bg_col(uint8_t action, pixel_t colour) {
+   sync_vdu_queue();
    prim_set_bg_plotmode(screen, action);
    prim_set_bg_col(screen, colour);
 }
 
 // Set the foreground text colour directly, bypassing the colour/tint VDU variables
 void fb_set_c_fg_col(pixel_t colour) {
+   sync_vdu_queue();
    c_fg_col = colour;
 }
 
 // Set the background text colour directly, bypassing the colour/tint VDU variables
 void fb_set_c_bg_col(pixel_t colour) {
+   sync_vdu_queue();
    c_bg_col = colour;
 }
 
 // Extracts the VDU gcol number (0..255) from the 8-bit colour number
 // It is an error to use this function in high colour modes
 uint8_t fb_get_gcol_from_colnum(uint8_t colnum) {
+   sync_vdu_queue();
    if (screen->ncolour < 255) {
       return (uint8_t)(colnum & screen->ncolour);
    } else if (screen->ncolour == 255) {
@@ -72,6 +72,15 @@ typedef enum {
    V_WINDOWHEIGHT    = 257  // &101 Height of text window in chars
 } vdu_variable_t;
 
+typedef struct {
+   unsigned int size;       // Capacity of the VDU queue
+   unsigned int depth;      // Characters currently queued
+   unsigned int peak_depth; // Most characters ever queued
+   unsigned int stalls;     // Times the parasite was held off at the high-water mark
+   unsigned int stall_time; // Total time the parasite was held off (us)
+   unsigned int overflows;  // Host characters dropped because the queue was full
+} vdu_queue_stats_t;
+
 void fb_initialize();
 
 void fb_show_splash_screen();
@@ -84,10 +93,18 @@ void fb_writec_buffered(char c);
 
 void fb_process_vdu_queue();
 
+void fb_start_vdu_core(unsigned int core);
+
+void fb_run_vdu_core();
+
 void fb_writec(char c);
 
+void fb_writen(const char *string, unsigned int len);
+
 void fb_writes(const char *string);
 
+void fb_get_vdu_queue_stats(vdu_queue_stats_t *stats, int reset);
+
 uint32_t fb_get_address();
 
 int fb_get_cursor_x();
@@ -47,6 +47,48 @@ static SWIDescriptor_Type colourtrans_table[] = {
     { NULL, "SelectTable" }                   // &40763
 };
 
+// Redraw loops set the same few colours over and over, so recent palette entry
+// to colour translations are kept in a small direct mapped cache, which is only
+// valid for the screen mode and palette it was filled for
+
+#define CACHE_SIZE    64
+#define CACHE_INVALID 0xFFFFFFFF   // never matches, as palette entries are &BBGGRR00
+
+typedef struct {
+   unsigned int entry;
+   pixel_t      col;
+} cache_entry_t;
+
+static cache_entry_t   cache[CACHE_SIZE];
+static screen_mode_t  *cache_screen;
+static uint32_t        cache_palette_version;
+
+static void invalidate_cache() {
+   for (int i = 0; i < CACHE_SIZE; i++) {
+      cache[i].entry = CACHE_INVALID;
+   }
+   cache_screen = NULL;
+}
+
+static pixel_t nearest_colour(screen_mode_t *screen, unsigned int entry) {
+   entry &= 0xFFFFFF00;
+   uint32_t version = get_palette_version();
+   if (screen != cache_screen || version != cache_palette_version) {
+      invalidate_cache();
+      cache_screen = screen;
+      cache_palette_version = version;
+   }
+   cache_entry_t *e = cache + (((entry >> 8) ^ (entry >> 14) ^ (entry >> 21)) & (CACHE_SIZE - 1));
+   if (e->entry != entry) {
+      uint8_t r = (uint8_t)((entry >>  8) & 0xff);
+      uint8_t g = (uint8_t)((entry >> 16) & 0xff);
+      uint8_t b = (uint8_t)((entry >> 24) & 0xff);
+      e->entry = entry;
+      e->col = screen->nearest_colour(screen, r, g, b);
+   }
+   return e->col;
+}
+
 // Entry
 //   R0	Palette entry
 //   R3	Flags
@@ -57,13 +99,10 @@ static SWIDescriptor_Type colourtrans_table[] = {
 //   R3	Initial value AND &80
 //   R4	Preserved
 static void colourtrans_setgcol(unsigned int *reg) {
-   uint8_t r = (uint8_t)((reg[0] >>  8) & 0xff);
-   uint8_t g = (uint8_t)((reg[0] >> 16) & 0xff);
-   uint8_t b = (uint8_t)((reg[0] >> 24) & 0xff);
    unsigned int flags = reg[3];
    uint8_t action = reg[4] & 7;
    screen_mode_t *screen = fb_get_current_screen_mode();
-   pixel_t col = screen->nearest_colour(screen, r, g, b);
+   pixel_t col = nearest_colour(screen, reg[0]);
    if (flags & 0x80) {
       fb_set_g_bg_col(action, col);
    } else {
@@ -81,12 +120,9 @@ static void colourtrans_setgcol(unsigned int *reg) {
 //   R0	GCOL
 //   R3	Preserved
 static void colourtrans_settextcolour(unsigned int *reg) {
-   uint8_t r = (uint8_t)((reg[0] >>  8) & 0xff);
-   uint8_t g = (uint8_t)((reg[0] >> 16) & 0xff);
-   uint8_t b = (uint8_t)((reg[0] >> 24) & 0xff);
    unsigned int flags = reg[3];
    screen_mode_t *screen = fb_get_current_screen_mode();
-   pixel_t col = screen->nearest_colour(screen, r, g, b);
+   pixel_t col = nearest_colour(screen, reg[0]);
    if (flags & 0x80) {
       fb_set_c_bg_col(col);
    } else {
@@ -95,9 +131,19 @@ static void colourtrans_settextcolour(unsigned int *reg) {
    reg[0] = (unsigned int )col;
 }
 
+// Entry
+//   No parameters
+// Exit
+//   All registers preserved
+static void colourtrans_invalidatecache(unsigned int *reg) {
+   invalidate_cache();
+}
+
 static void colourtrans_init(int vdu) {
-   colourtrans_table[SWI_COLOURTRANS_SETGCOL       - COLOURTRANS_MIN].handler = vdu ? colourtrans_setgcol       : NULL;
-   colourtrans_table[SWI_COLOURTRANS_SETTEXTCOLOUR - COLOURTRANS_MIN].handler = vdu ? colourtrans_settextcolour : NULL;
+   invalidate_cache();
+   colourtrans_table[SWI_COLOURTRANS_SETGCOL         - COLOURTRANS_MIN].handler = vdu ? colourtrans_setgcol         : NULL;
+   colourtrans_table[SWI_COLOURTRANS_SETTEXTCOLOUR   - COLOURTRANS_MIN].handler = vdu ? colourtrans_settextcolour   : NULL;
+   colourtrans_table[SWI_COLOURTRANS_INVALIDATECACHE - COLOURTRANS_MIN].handler = vdu ? colourtrans_invalidatecache : NULL;
 }
 
 module_t module_colourtrans = {
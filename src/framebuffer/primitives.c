@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
 #include "primitives.h"
 #include "framebuffer.h"
 #include "fonts.h"
@@ -56,6 +57,11 @@ static int      g_ecf_giant_shift;
 static int      g_ecf_mask;
 static int      g_ecf_mode;
 
+// One row of an ECF expanded into frame buffer pixels; every pattern repeats
+// within 32 pixels (the widest is a giant ECF in a 2 colour mode)
+#define ECF_ROW_LEN 32
+static uint32_t g_ecf_row[ECF_ROW_LEN];
+
 // Default Dot Patterns
 static uint8_t DEFAULT_DOT_PATTERN[] = {0xAA, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
@@ -64,12 +70,38 @@ static uint8_t g_dot_pattern[64];
 static int     g_dot_pattern_len;
 static int     g_dot_pattern_index;
 
-#define FLOOD_QUEUE_SIZE 16384
+// Flood fill span stack, grown on demand and kept between fills
+#define FLOOD_STACK_INITIAL 4096
+
+typedef struct {
+   int16_t x1;
+   int16_t x2;
+   int16_t y;
+   int16_t dy;
+} flood_span_t;
+
+static flood_span_t *flood_stack;
+static int flood_stack_size;
+static int flood_stack_ptr;
+
+// Flood fill visited bitmap (one bit per pixel of the graphics window)
+static uint32_t *flood_visited;
+static size_t flood_visited_size;
+static int flood_visited_pitch;
 
-static int16_t flood_queue_x[FLOOD_QUEUE_SIZE];
-static int16_t flood_queue_y[FLOOD_QUEUE_SIZE];
-static int flood_queue_wr;
-static int flood_queue_rd;
+typedef enum {
+   FT_STOP_EQ,       // Stop at pixels matching the reference colour, or marked pixels
+   FT_STOP_NE,       // Stop at pixels not matching the reference colour
+   FT_STOP_UNMARKED  // Stop at pixels without the marker bit set
+} fill_stop_t;
+
+typedef struct {
+   fill_stop_t stop;
+   pixel_t     colour;  // the reference colour
+   plotmode_t  ecf;     // if an ECF plot mode, the reference colour comes from the pattern
+   pixel_t     marker;  // marker bit that also stops FT_STOP_EQ fills (0 if unused)
+   int         visited; // track filled pixels, for fills that don't create their own boundary
+} fill_test_t;
 
 // Rodders: Quadrant definitions for arc rendering
 typedef enum {
@@ -80,11 +112,6 @@ typedef enum {
    Q_ALL
 } quadrant_t;
 
-static int16_t arc_end_x;
-static int16_t arc_end_y;
-static int16_t arc_fill_x;
-static int16_t arc_fill_y;
-
 #define NUM_SPRITES 256
 
 typedef struct {
@@ -96,6 +123,11 @@ typedef struct {
 
 static sprite_t sprites[NUM_SPRITES];
 
+// Per-scanline left/right extents, used by the polygon and conic fills
+static int *span_xl;
+static int *span_xr;
+static int  span_rows;
+
 // ==========================================================================
 // Static methods (operate at screen resolution)
 // ==========================================================================
@@ -108,10 +140,27 @@ static inline int min(int a, int b) {
    return (a < b) ? a : b;
 }
 
+static inline int64_t max64(int64_t a, int64_t b) {
+   return (a > b) ? a : b;
+}
+
+static inline int64_t min64(int64_t a, int64_t b) {
+   return (a < b) ? a : b;
+}
+
 static int calc_radius(int x1, int y1, int x2, int y2) {
    return (int)(sqrtf((float)((x2-x1)*(x2-x1)+(y2-y1)*(y2-y1))) + 0.5F);
 }
 
+static inline pixel_t ecf_colour(plotmode_t plotmode, int x, int y) {
+   int ecfnum = (plotmode >> 4) - 1;
+   // Giant ECF
+   if (ecfnum >= 4) {
+      ecfnum = ((x - g_ecf_origin_x) >> g_ecf_giant_shift) & 3;
+   }
+   return g_ecf_pattern[ecfnum][(((y - g_ecf_origin_y) & 7) << 3) + ((x - g_ecf_origin_x) & g_ecf_mask)];
+}
+
 static pixel_t get_pixel(screen_mode_t *screen, int x, int y) {
    if (x < g_x_min  || x > g_x_max || y < g_y_min || y > g_y_max) {
       // Return the graphics background colour if off the screen
@@ -141,12 +190,7 @@ static void set_pixel(screen_mode_t *screen, int x, int y, plotcol_t col) {
       colour   = 0; // not used
    }
    if (plotmode >= PM_ECF) {
-      int ecfnum = (plotmode >> 4) - 1;
-      // Giant ECF
-      if (ecfnum >= 4) {
-         ecfnum = ((x - g_ecf_origin_x) >> g_ecf_giant_shift) & 3;
-      }
-      colour = g_ecf_pattern[ecfnum][(((y - g_ecf_origin_y) & 7) << 3) + ((x - g_ecf_origin_x) & g_ecf_mask)];
+      colour = ecf_colour(plotmode, x, y);
       plotmode &= 0x0F;
    }
    if (plotmode != PM_NORMAL) {
@@ -181,51 +225,261 @@ static void set_pixel(screen_mode_t *screen, int x, int y, plotcol_t col) {
    screen->set_pixel(screen, x, y, colour);
 }
 
+// Write a clipped row of pixels directly to the frame buffer
+static void fill_row(screen_mode_t *screen, int x1, int x2, int y, pixel_t colour) {
+   uint8_t *row = get_fb_row(screen, y);
+   switch (screen->log2bpp) {
+   case 4:
+      {
+         uint16_t *fbptr = (uint16_t *)row + x1;
+         for (int x = x1; x <= x2; x++) {
+            *fbptr++ = (uint16_t)colour;
+         }
+      }
+      break;
+   case 5:
+      {
+         uint32_t *fbptr = (uint32_t *)row + x1;
+         for (int x = x1; x <= x2; x++) {
+            *fbptr++ = colour;
+         }
+      }
+      break;
+   default:
+      memset(row + x1, (int)(colour & 0xff), (size_t)(x2 - x1 + 1));
+      break;
+   }
+   mark_dirty(screen, x1, x2, y, y);
+}
+
+// Expand n pixels (at most ECF_ROW_LEN) of an ECF starting at x, y into g_ecf_row in frame buffer format
+static void ecf_expand_row(int log2bpp, plotmode_t plotmode, int x, int y, int n) {
+   uint8_t *ptr = (uint8_t *)g_ecf_row;
+   for (int i = 0; i < n; i++) {
+      pixel_t colour = ecf_colour(plotmode, x + i, y);
+      switch (log2bpp) {
+      case 4:  ((uint16_t *)ptr)[i] = (uint16_t)colour; break;
+      case 5:  ((uint32_t *)ptr)[i] = colour;           break;
+      default: ptr[i] = (uint8_t)colour;                break;
+      }
+   }
+}
+
+static inline __attribute__((always_inline)) void ecf_row_bpp(uint8_t *fbptr, int n, int log2bpp, plotmode_t plotmode) {
+   const int shift = log2bpp - 3;
+   const uint8_t *row = (const uint8_t *)g_ecf_row;
+   if (plotmode == PM_NORMAL) {
+      // Copy the pattern row a repeat at a time
+      while (n > 0) {
+         int len = min(n, ECF_ROW_LEN);
+         memcpy(fbptr, row, (size_t)len << shift);
+         fbptr += len << shift;
+         n -= len;
+      }
+      return;
+   }
+   for (int i = 0; i < n; i++) {
+      int j = i & (ECF_ROW_LEN - 1);
+      pixel_t colour;
+      pixel_t existing;
+      switch (log2bpp) {
+      case 4:
+         colour = ((const uint16_t *)row)[j];
+         existing = ((uint16_t *)fbptr)[i];
+         break;
+      case 5:
+         colour = ((const uint32_t *)row)[j];
+         existing = ((uint32_t *)fbptr)[i];
+         break;
+      default:
+         colour = row[j];
+         existing = fbptr[i];
+         break;
+      }
+      // Make sure the marker bits are clear; this is safe in all modes
+      existing &= ~marker;
+      switch (plotmode) {
+      case PM_OR:     colour |= existing;                      break;
+      case PM_AND:    colour &= existing;                      break;
+      case PM_XOR:    colour ^= existing;                      break;
+      case PM_INVERT: colour = max_col - existing;             break;
+      default:        colour = existing & (max_col - colour);  break;
+      }
+      switch (log2bpp) {
+      case 4:  ((uint16_t *)fbptr)[i] = (uint16_t)colour; break;
+      case 5:  ((uint32_t *)fbptr)[i] = colour;           break;
+      default: fbptr[i] = (uint8_t)colour;                break;
+      }
+   }
+}
+
+#define ECF_ROW_MODES(log2bpp) \
+   switch (plotmode & 0x0F) { \
+   case PM_NORMAL: ecf_row_bpp(fbptr, n, log2bpp, PM_NORMAL); break; \
+   case PM_OR:     ecf_row_bpp(fbptr, n, log2bpp, PM_OR);     break; \
+   case PM_AND:    ecf_row_bpp(fbptr, n, log2bpp, PM_AND);    break; \
+   case PM_XOR:    ecf_row_bpp(fbptr, n, log2bpp, PM_XOR);    break; \
+   case PM_INVERT: ecf_row_bpp(fbptr, n, log2bpp, PM_INVERT); break; \
+   default:        ecf_row_bpp(fbptr, n, log2bpp, PM_AND_INVERTED); break; \
+   }
+
+// Fill a clipped row with an ECF, expanding the pattern once for the row rather than per pixel
+static void fill_row_ecf(screen_mode_t *screen, int x1, int x2, int y, plotmode_t plotmode) {
+   int n = x2 - x1 + 1;
+   if ((plotmode & 0x0F) == PM_UNCHANGED) {
+      // Nothing to plot, other than clearing any marker bits
+      if (marker) {
+         for (int x = x1; x <= x2; x++) {
+            screen->set_pixel(screen, x, y, screen->get_pixel(screen, x, y) & ~marker);
+         }
+      }
+      return;
+   }
+   ecf_expand_row(screen->log2bpp, plotmode, x1, y, min(n, ECF_ROW_LEN));
+   uint8_t *fbptr = get_fb_row(screen, y) + (x1 << (screen->log2bpp - 3));
+   switch (screen->log2bpp) {
+   case 4:
+      ECF_ROW_MODES(4);
+      break;
+   case 5:
+      ECF_ROW_MODES(5);
+      break;
+   default:
+      ECF_ROW_MODES(3);
+      break;
+   }
+   mark_dirty(screen, x1, x2, y, y);
+}
+
 static void draw_hline(screen_mode_t *screen, int x1, int x2, int y, plotcol_t colour) {
    if (x1 > x2) {
       int tmp = x1;
       x1 = x2;
       x2 = tmp;
    }
+   // Clip to the graphics window
+   if (y < g_y_min || y > g_y_max) {
+      return;
+   }
+   x1 = max(x1, g_x_min);
+   x2 = min(x2, g_x_max);
+   if (x1 > x2) {
+      return;
+   }
+   // Solid colours can be written directly to the frame buffer
+   if (colour == PC_FG && g_fg_plotmode == PM_NORMAL) {
+      fill_row(screen, x1, x2, y, g_fg_col);
+      return;
+   }
+   if (colour == PC_BG && g_bg_plotmode == PM_NORMAL) {
+      fill_row(screen, x1, x2, y, g_bg_col);
+      return;
+   }
+   // As can patterned ones, a row of the pattern at a time
+   if (colour == PC_FG && g_fg_plotmode >= PM_ECF) {
+      fill_row_ecf(screen, x1, x2, y, g_fg_plotmode);
+      return;
+   }
+   if (colour == PC_BG && g_bg_plotmode >= PM_ECF) {
+      fill_row_ecf(screen, x1, x2, y, g_bg_plotmode);
+      return;
+   }
    for (int x = x1; x <= x2; x++) {
       set_pixel(screen, x, y, colour);
    }
 }
 
-static void fill_bottom_flat_triangle(screen_mode_t *screen, int x1, int y1, int x2, int y2, int x3, int y3, plotcol_t colour) {
-   // Note: y2 and y3 are the same, so the below test is slightly redundant
-   if (y1 == y2 || y1 == y3) {
-      draw_hline(screen, (int)x2, (int)x3, y1, colour);
-   } else {
-      float invslope1 = ((float) (x2 - x1)) / ((float) (y1 - y2));
-      float invslope2 = ((float) (x3 - x1)) / ((float) (y1 - y3));
-      float curx1 = 0.5f + (float)x1;
-      float curx2 = curx1;
-      for (int scanlineY = y1; scanlineY >= y2; scanlineY--) {
-         draw_hline(screen, (int)curx1, (int)curx2, scanlineY, colour);
-         curx1 += invslope1;
-         curx2 += invslope2;
+// Prepare the span buffer for rows y1 to y2 (which must already be clipped),
+// returning FALSE if the span buffer couldn't be allocated
+static int span_reset(int y1, int y2) {
+   if (!span_xl || !span_xr) {
+      return FALSE;
+   }
+   for (int y = y1; y <= y2; y++) {
+      span_xl[y] = INT_MAX;
+      span_xr[y] = INT_MIN;
+   }
+   return TRUE;
+}
+
+// Extend row y of the span buffer to include x1..x2 (rows outside the graphics window are ignored)
+static void span_add_row(int y, int x1, int x2) {
+   if (y < g_y_min || y > g_y_max) {
+      return;
+   }
+   if (x1 > x2) {
+      int tmp = x1;
+      x1 = x2;
+      x2 = tmp;
+   }
+   if (x1 < span_xl[y]) {
+      span_xl[y] = x1;
+   }
+   if (x2 > span_xr[y]) {
+      span_xr[y] = x2;
+   }
+}
+
+// Extend the span buffer to include an edge, walked in 16.16 fixed point
+static void span_add_edge(int x1, int y1, int x2, int y2) {
+   // Always walk from the bottom, so shared edges are rounded identically
+   if (y1 > y2) {
+      int tmp;
+      tmp = x1; x1 = x2; x2 = tmp;
+      tmp = y1; y1 = y2; y2 = tmp;
+   }
+   int ya = max(y1, g_y_min);
+   int yb = min(y2, g_y_max);
+   if (ya > yb) {
+      return;
+   }
+   if (y1 == y2) {
+      span_add_row(y1, x1, x2);
+      return;
+   }
+   int64_t step = ((int64_t)(x2 - x1) * 65536) / (y2 - y1);
+   int64_t x = (int64_t)x1 * 65536 + 0x8000 + step * (ya - y1);
+   for (int y = ya; y <= yb; y++) {
+      int xi = (int)(x >> 16);
+      if (xi < span_xl[y]) {
+         span_xl[y] = xi;
+      }
+      if (xi > span_xr[y]) {
+         span_xr[y] = xi;
       }
+      x += step;
    }
 }
 
-static void fill_top_flat_triangle(screen_mode_t *screen, int x1, int y1, int x2, int y2, int x3, int y3, plotcol_t colour) {
-   // Note: y1 and y2 are the same, so the below test is slightly redundant
-   if (y1 == y3 || y2 == y3) {
-      draw_hline(screen, (int)x1, (int)x2, y3, colour);
-   } else {
-      float invslope1 = ((float) (x3 - x1)) / ((float) (y1 - y3));
-      float invslope2 = ((float) (x3 - x2)) / ((float) (y2 - y3));
-      float curx1 = 0.5f + (float)x3;
-      float curx2 = curx1;
-      for (int scanlineY = y3; scanlineY <= y1; scanlineY++) {
-         draw_hline(screen, (int)curx1, (int)curx2, scanlineY, colour);
-         curx1 -= invslope1;
-         curx2 -= invslope2;
+// Fill each row of the span buffer exactly once (so XOR plotting works)
+static void span_fill(screen_mode_t *screen, int y1, int y2, plotcol_t colour) {
+   for (int y = y1; y <= y2; y++) {
+      if (span_xl[y] <= span_xr[y]) {
+         draw_hline(screen, span_xl[y], span_xr[y], y, colour);
       }
    }
 }
 
+// Fill a convex polygon, including its edges
+static void fill_convex_polygon(screen_mode_t *screen, const int *xs, const int *ys, int n, plotcol_t colour) {
+   int y1 = ys[0];
+   int y2 = ys[0];
+   for (int i = 1; i < n; i++) {
+      y1 = min(y1, ys[i]);
+      y2 = max(y2, ys[i]);
+   }
+   y1 = max(y1, g_y_min);
+   y2 = min(y2, g_y_max);
+   if (y1 > y2 || !span_reset(y1, y2)) {
+      return;
+   }
+   for (int i = 0; i < n; i++) {
+      int j = (i + 1) % n;
+      span_add_edge(xs[i], ys[i], xs[j], ys[j]);
+   }
+   span_fill(screen, y1, y2, colour);
+}
+
 // Rodders: Arc drawing routines, used by chord and sector fills
 static unsigned int arc_quadrant(int x, int y) {
    if (x >= 0) {
@@ -363,29 +617,46 @@ static void draw_circle(screen_mode_t *screen, int xc, int yc, int r, plotcol_t
    }
 }
 
-static void fill_circle(screen_mode_t *screen, int xc, int yc, int r, plotcol_t colour) {
+// Add the rows of a filled circle to the span buffer (which must already be reset)
+static void span_add_circle(int xc, int yc, int r) {
    int x = 0;
    int y = r;
    int p = 3 - (2 * r);
    while (x < y) {
-      draw_hline(screen, xc + y, xc - y, yc + x, colour);
-      if (x > 0) {
-         draw_hline(screen, xc + y, xc - y, yc - x, colour);
-      }
+      span_add_row(yc + x, xc - y, xc + y);
+      span_add_row(yc - x, xc - y, xc + y);
       if (p < 0) {
          p += 4 * x + 6;
          x++;
       } else {
-         draw_hline(screen, xc + x, xc - x, yc - y, colour);
-         draw_hline(screen, xc + x, xc - x, yc + y, colour);
+         span_add_row(yc - y, xc - x, xc + x);
+         span_add_row(yc + y, xc - x, xc + x);
          p += 4 * (x - y) + 10;
          x++;
          y--;
       }
    }
    if (x == y) {
-      draw_hline(screen, xc + x, xc - x, yc - y, colour);
-      draw_hline(screen, xc + x, xc - x, yc + y, colour);
+      span_add_row(yc - y, xc - x, xc + x);
+      span_add_row(yc + y, xc - x, xc + x);
+   }
+}
+
+// Clip the rows yc - h .. yc + h to the graphics window, and reset them in the span buffer
+static int span_reset_rows(int yc, int h, int *y1, int *y2) {
+   *y1 = max(yc - h, g_y_min);
+   *y2 = min(yc + h, g_y_max);
+   if (*y1 > *y2) {
+      return FALSE;
+   }
+   return span_reset(*y1, *y2);
+}
+
+static void fill_circle(screen_mode_t *screen, int xc, int yc, int r, plotcol_t colour) {
+   int y1, y2;
+   if (span_reset_rows(yc, r, &y1, &y2)) {
+      span_add_circle(xc, yc, r);
+      span_fill(screen, y1, y2, colour);
    }
 }
 
@@ -531,7 +802,11 @@ static void fill_normal_ellipse(screen_mode_t *screen, int xc, int yc, int width
       set_pixel(screen, xc, yc, colour);
       return;
    }
-   // Fill the ellipse
+   // Fill the ellipse, collecting the widest extent of each row in the span buffer
+   int y1, y2;
+   if (!span_reset_rows(yc, height, &y1, &y2)) {
+      return;
+   }
    int a2 = width * width;
    int b2 = height * height;
    int fa2 = 4 * a2, fb2 = 4 * b2;
@@ -539,8 +814,8 @@ static void fill_normal_ellipse(screen_mode_t *screen, int xc, int yc, int width
    /* First half */
    for (x = 0, y = height, sigma = 2 * b2 + a2 * (1 - 2 * height); b2 * x <= a2 * y; x++) {
       if (sigma >= 0) {
-         draw_hline(screen, xc + x, xc - x, yc + y, colour);
-         draw_hline(screen, xc + x, xc - x, yc - y, colour);
+         span_add_row(yc + y, xc - x, xc + x);
+         span_add_row(yc - y, xc - x, xc + x);
          sigma += fa2 * (1 - y);
          y--;
       }
@@ -548,16 +823,15 @@ static void fill_normal_ellipse(screen_mode_t *screen, int xc, int yc, int width
    }
    /* Second half */
    for (x = width, y = 0, sigma = 2 * a2 + b2 * (1 - 2 * width); a2 * y <= b2 * x; y++) {
-      draw_hline(screen, xc + x, xc - x, yc + y, colour);
-      if (y > 0) {
-         draw_hline(screen, xc + x, xc - x, yc - y, colour);
-      }
+      span_add_row(yc + y, xc - x, xc + x);
+      span_add_row(yc - y, xc - x, xc + x);
       if (sigma >= 0) {
          sigma += fb2 * (1 - x);
          x--;
       }
       sigma += a2 * ((4 * y) + 6);
    }
+   span_fill(screen, y1, y2, colour);
 }
 
 static void fill_sheared_ellipse(screen_mode_t *screen, int xc, int yc, int width, int height, int shear, plotcol_t colour) {
@@ -565,6 +839,10 @@ static void fill_sheared_ellipse(screen_mode_t *screen, int xc, int yc, int widt
    if (height == 0) {
       draw_hline(screen, xc - width, xc + width, yc, colour);
    } else {
+      int y1, y2;
+      if (!span_reset_rows(yc, height, &y1, &y2)) {
+         return;
+      }
       float axis_ratio = (float) width / (float) height;
       float shear_per_line = (float) (shear) / (float) height;
       float xshear = 0.0;
@@ -579,12 +857,13 @@ static void fill_sheared_ellipse(screen_mode_t *screen, int xc, int yc, int widt
          // It's probably quicker to just use y * y
          y_squared += odd_sequence;
          odd_sequence += 2;
-         // Draw the slice as a single horizintal line
-         draw_hline(screen, xc + xl, xc + xr, yc + y, colour);
+         // Each slice is a single horizontal span
+         span_add_row(yc + y, xc + xl, xc + xr);
          if (y > 0) {
-            draw_hline(screen, xc - xl, xc - xr, yc - y, colour);
+            span_add_row(yc - y, xc - xl, xc - xr);
          }
       }
+      span_fill(screen, y1, y2, colour);
    }
 }
 
@@ -631,6 +910,23 @@ void prim_init (screen_mode_t *screen) {
    max_col = (pixel_t) screen->ncolour;
    // marker is used when flood filling, if there are spare bits in the frame buffer
    marker = (pixel_t) (screen->ncolour + 1);
+   // span buffer needs an entry for each row of the screen
+   if (span_rows < screen->height) {
+      free(span_xl);
+      free(span_xr);
+      span_xl = malloc((size_t)screen->height * sizeof(int));
+      span_xr = malloc((size_t)screen->height * sizeof(int));
+      if (span_xl && span_xr) {
+         span_rows = screen->height;
+      } else {
+         // Filled shapes are skipped until a later mode change succeeds
+         free(span_xl);
+         free(span_xr);
+         span_xl = NULL;
+         span_xr = NULL;
+         span_rows = 0;
+      }
+   }
 }
 
 void prim_set_fg_col(screen_mode_t *screen, pixel_t colour) {
@@ -867,6 +1163,125 @@ int prim_on_screen(screen_mode_t *screen, int x, int y) {
 // Rodders: Line mode support
 // Implementation of Bresenham's line drawing algorithm from here:
 // http://tech-algorithm.com/articles/drawing-line-using-bresenham-algorithm/
+// A Bresenham line, stepping one pixel along the major axis each time, and
+// also along the minor axis when the error term reaches longest
+typedef struct {
+   int x;         // First pixel to plot
+   int y;
+   int diag;      // Frame buffer offsets of the diagonal and major axis steps
+   int axis;
+   int numerator; // Error term at the first pixel
+   int longest;
+   int shortest;
+   int count;     // Number of pixels to plot
+} line_t;
+
+// Plot count pixels of a pre-clipped line directly in the frame buffer,
+// specialised for each pixel size and simple plot mode
+static inline __attribute__((always_inline)) void line_loop_bpp(uint8_t *fbptr, const line_t *line, int dotted, int log2bpp, plotmode_t plotmode, pixel_t colour) {
+   int numerator = line->numerator;
+   int index = g_dot_pattern_index;
+   for (int i = 0; i < line->count; i++) {
+      if (!dotted || g_dot_pattern[index]) {
+         pixel_t existing = 0;
+         if (plotmode != PM_NORMAL) {
+            switch (log2bpp) {
+            case 4:  existing = *(uint16_t *)fbptr; break;
+            case 5:  existing = *(uint32_t *)fbptr; break;
+            default: existing = *fbptr;             break;
+            }
+            // Make sure the marker bits are clear; this is safe in all modes
+            existing &= ~marker;
+         }
+         pixel_t value;
+         switch (plotmode) {
+         case PM_OR:     value = existing | colour;   break;
+         case PM_AND:    value = existing & colour;   break;
+         case PM_XOR:    value = existing ^ colour;   break;
+         case PM_INVERT: value = max_col - existing;  break;
+         default:        value = colour;              break;
+         }
+         switch (log2bpp) {
+         case 4:  *(uint16_t *)fbptr = (uint16_t)value; break;
+         case 5:  *(uint32_t *)fbptr = value;           break;
+         default: *fbptr = (uint8_t)value;              break;
+         }
+      }
+      if (dotted && ++index == g_dot_pattern_len) {
+         index = 0;
+      }
+      numerator += line->shortest;
+      if (numerator >= line->longest) {
+         numerator -= line->longest;
+         fbptr += line->diag;
+      } else {
+         fbptr += line->axis;
+      }
+   }
+}
+
+#define LINE_LOOP_MODES(log2bpp) \
+   switch (plotmode) { \
+   case PM_NORMAL: line_loop_bpp(fbptr, line, dotted, log2bpp, PM_NORMAL, colour); break; \
+   case PM_OR:     line_loop_bpp(fbptr, line, dotted, log2bpp, PM_OR,     colour); break; \
+   case PM_AND:    line_loop_bpp(fbptr, line, dotted, log2bpp, PM_AND,    colour); break; \
+   case PM_XOR:    line_loop_bpp(fbptr, line, dotted, log2bpp, PM_XOR,    colour); break; \
+   default:        line_loop_bpp(fbptr, line, dotted, log2bpp, PM_INVERT, colour); break; \
+   }
+
+// Returns FALSE if the plot mode needs the general set_pixel path
+static int line_loop(screen_mode_t *screen, const line_t *line, int dotted, plotcol_t col) {
+   plotmode_t plotmode;
+   pixel_t colour;
+   switch (col) {
+   case PC_FG:
+      plotmode = g_fg_plotmode;
+      colour   = g_fg_col;
+      break;
+   case PC_BG:
+      plotmode = g_bg_plotmode;
+      colour   = g_bg_col;
+      break;
+   default:
+      plotmode = PM_INVERT;
+      colour   = 0; // not used
+   }
+   if (plotmode > PM_INVERT) {
+      return FALSE;
+   }
+   uint8_t *fbptr = get_fb_row(screen, line->y) + (line->x << (screen->log2bpp - 3));
+   switch (screen->log2bpp) {
+   case 4:
+      LINE_LOOP_MODES(4);
+      break;
+   case 5:
+      LINE_LOOP_MODES(5);
+      break;
+   default:
+      LINE_LOOP_MODES(3);
+      break;
+   }
+   return TRUE;
+}
+
+// Floor of a / b, for b > 0
+static inline int64_t floor_div64(int64_t a, int64_t b) {
+   return (a >= 0) ? (a / b) : -((b - 1 - a) / b);
+}
+
+// Restrict kmin..kmax to the steps k where c0 + k * dir lies within cmin..cmax
+static void clip_line_axis(int c0, int dir, int cmin, int cmax, int64_t *kmin, int64_t *kmax) {
+   if (dir > 0) {
+      *kmin = max64(*kmin, cmin - c0);
+      *kmax = min64(*kmax, cmax - c0);
+   } else if (dir < 0) {
+      *kmin = max64(*kmin, c0 - cmax);
+      *kmax = min64(*kmax, c0 - cmin);
+   } else if (c0 < cmin || c0 > cmax) {
+      *kmax = *kmin - 1;
+   }
+}
+
 void prim_draw_line(screen_mode_t *screen, int x1, int y1, int x2, int y2, plotcol_t colour, uint8_t linemode) {
    int w = x2 - x1;
    int h = y2 - y1;
@@ -874,246 +1289,356 @@ void prim_draw_line(screen_mode_t *screen, int x1, int y1, int x2, int y2, plotc
    int dotted =     (mask == 0x10 || mask == 0x18 || mask == 0x30 || mask == 0x38); // Dotted line
    int omit_first = (mask == 0x20 || mask == 0x28 || mask == 0x30 || mask == 0x38); // Omit first
    int omit_last =  (mask == 0x08 || mask == 0x18 || mask == 0x28 || mask == 0x38); // Omit last
-   int dx1 = 0, dy1 = 0, dx2 = 0, dy2 = 0;
-   if (w < 0) {
-      dx1 = -1;
-   } else if (w > 0) {
-      dx1 = 1;
-   }
-   if (h < 0) {
-      dy1 = -1;
-   } else if (h > 0) {
-      dy1 = 1;
-   }
-   if (w < 0) {
-      dx2 = -1;
-   } else if (w > 0) {
-      dx2 = 1;
-   }
-   int longest = abs(w);
-   int shortest = abs(h);
-   if (!(longest > shortest)) {
-      longest = abs(h);
-      shortest = abs(w);
-      if (h < 0) {
-         dy2 = -1;
-      } else if (h > 0) {
-         dy2 = 1;
-      }
-      dx2 = 0;
-   }
-   int numerator = longest >> 1 ;
-   int x = x1;
-   int y = y1;
-   if (omit_last) {
-      longest--;
-   }
-   int start = 0;
+   int sx = (w > 0) - (w < 0);
+   int sy = (h > 0) - (h < 0);
+   int x_major = abs(w) > abs(h);
+   int longest  = x_major ? abs(w) : abs(h);
+   int shortest = x_major ? abs(h) : abs(w);
+   // After k steps the position along the major axis has moved k pixels, and
+   // along the minor axis m(k) = (numerator0 + k * shortest) / longest pixels
+   int numerator0 = longest >> 1;
+   // The steps k that are plotted (omitting the endpoints doesn't change the path)
+   int first = omit_first ? 1 : 0;
+   int last = omit_last ? longest - 1 : longest;
    // restart the dot pattern if the first point is plotted
    if (!omit_first) {
       g_dot_pattern_index = 0;
    }
-   for (int i = start; i <= longest; i++) {
-      if (i > start || !omit_first) {
-         if (dotted) {
-            if (g_dot_pattern[g_dot_pattern_index++]) {
+   if (first > last) {
+      return;
+   }
+
+   // Clip the line to the graphics window, before walking it. This gives the
+   // same pixels as walking the whole line and discarding those outside.
+   int a0   = x_major ? x1 : y1;
+   int adir = x_major ? sx : sy;
+   int b0   = x_major ? y1 : x1;
+   int bdir = x_major ? sy : sx;
+   int amin = x_major ? g_x_min : g_y_min;
+   int amax = x_major ? g_x_max : g_y_max;
+   int bmin = x_major ? g_y_min : g_x_min;
+   int bmax = x_major ? g_y_max : g_x_max;
+   int64_t kmin = first;
+   int64_t kmax = last;
+   clip_line_axis(a0, adir, amin, amax, &kmin, &kmax);
+   if (shortest == 0) {
+      clip_line_axis(b0, 0, bmin, bmax, &kmin, &kmax);
+   } else {
+      // Convert the minor axis limits into limits on m(k), and then into limits on k
+      int64_t mlo = (bdir > 0) ? bmin - b0 : b0 - bmax;
+      int64_t mhi = (bdir > 0) ? bmax - b0 : b0 - bmin;
+      kmin = max64(kmin, -floor_div64(numerator0 - mlo * longest, shortest));
+      kmax = min64(kmax, floor_div64((mhi + 1) * longest - 1 - numerator0, shortest));
+   }
+
+   // The dot pattern continues from the first plotted point, whether or not it is visible
+   int total = last - first + 1;
+   if (kmin <= kmax) {
+      int k = (int) kmin;
+      int64_t n = numerator0 + (int64_t) k * shortest;
+      int m = longest ? (int)(n / longest) : 0;
+      line_t line;
+      line.x         = x_major ? x1 + k * sx : x1 + m * sx;
+      line.y         = x_major ? y1 + m * sy : y1 + k * sy;
+      line.numerator = longest ? (int)(n % longest) : 0;
+      line.longest   = longest;
+      line.shortest  = shortest;
+      line.count     = (int) (kmax - kmin) + 1;
+      // Rows are stored top down in the frame buffer
+      int xstep = sx << (screen->log2bpp - 3);
+      int ystep = -sy * screen->pitch;
+      line.diag = xstep + ystep;
+      line.axis = x_major ? xstep : ystep;
+      if (dotted) {
+         g_dot_pattern_index = (g_dot_pattern_index + (k - first)) % g_dot_pattern_len;
+      }
+      if (line_loop(screen, &line, dotted, colour)) {
+         // Mark the bounding box of the visible part of the line
+         int64_t ne = numerator0 + kmax * shortest;
+         int me = longest ? (int)(ne / longest) : 0;
+         int xe = x_major ? x1 + (int) kmax * sx : x1 + me * sx;
+         int ye = x_major ? y1 + me * sy : y1 + (int) kmax * sy;
+         mark_dirty(screen, min(line.x, xe), max(line.x, xe), min(line.y, ye), max(line.y, ye));
+      } else {
+         // Walk the visible part of the line with set_pixel (ECF and other plot modes)
+         int x = line.x;
+         int y = line.y;
+         int numerator = line.numerator;
+         int index = g_dot_pattern_index;
+         for (int i = 0; i < line.count; i++) {
+            if (!dotted || g_dot_pattern[index]) {
                set_pixel(screen, x, y, colour);
             }
-            if (g_dot_pattern_index == g_dot_pattern_len) {
-               g_dot_pattern_index = 0;
+            if (dotted && ++index == g_dot_pattern_len) {
+               index = 0;
+            }
+            numerator += shortest;
+            if (numerator >= longest) {
+               numerator -= longest;
+               x += sx;
+               y += sy;
+            } else if (x_major) {
+               x += sx;
+            } else {
+               y += sy;
             }
-         } else {
-            set_pixel(screen, x, y, colour);
          }
       }
-      numerator += shortest;
-      if (!(numerator < longest)) {
-         numerator -= longest;
-         x += dx1;
-         y += dy1;
-      } else {
-         x += dx2;
-         y += dy2;
-      }
+      total -= k - first;
+   }
+   if (dotted) {
+      g_dot_pattern_index = (g_dot_pattern_index + total) % g_dot_pattern_len;
    }
 }
 
 
-typedef int (*fill_test_fn)(screen_mode_t *, int, int);
+// ==========================================================================
+// Flood fill
+// ==========================================================================
+
+// This is a span based scanline fill (Heckbert, Graphics Gems 1990) that reads
+// the frame buffer rows directly, and keeps a stack of spans rather than pixels.
 
-static int test_pixel_bg_col(screen_mode_t *screen, int x, int y) {
-   return get_pixel(screen, x, y) == g_bg_col;
+static inline pixel_t read_row_pixel(const uint8_t *row, int x, int log2bpp) {
+   switch (log2bpp) {
+   case 4:
+      return ((const uint16_t *)row)[x];
+   case 5:
+      return ((const uint32_t *)row)[x];
+   default:
+      return row[x];
+   }
 }
 
+static inline int fill_stops(const fill_test_t *test, pixel_t px, int x, int y) {
+   pixel_t colour = (test->ecf >= PM_ECF) ? ecf_colour(test->ecf, x, y) : test->colour;
+   switch (test->stop) {
+   case FT_STOP_EQ:
+      return (px & test->marker) || px == colour;
+   case FT_STOP_NE:
+      return px != colour;
+   default:
+      return !(px & marker);
+   }
+}
 
-static int test_pixel_bg_ecf(screen_mode_t *screen, int x, int y) {
-   int ecfnum = (g_bg_plotmode >> 4) - 1;
-   // Giant ECF
-   if (ecfnum >= 4) {
-      ecfnum = ((x - g_ecf_origin_x) >> g_ecf_giant_shift) & 3;
+static inline int fill_visited(int x, int y) {
+   x -= g_x_min;
+   return (flood_visited[(y - g_y_min) * flood_visited_pitch + (x >> 5)] & (1u << (x & 31))) != 0;
+}
+
+static inline __attribute__((always_inline)) int fill_inside(const fill_test_t *test, const uint8_t *row, int x, int y, int log2bpp) {
+   if (fill_stops(test, read_row_pixel(row, x, log2bpp), x, y)) {
+      return 0;
    }
-   pixel_t colour = g_ecf_pattern[ecfnum][(((y - g_ecf_origin_y) & 7) << 3) + ((x - g_ecf_origin_x) & g_ecf_mask)];
-   return get_pixel(screen, x, y) == colour;
+   return !(test->visited && fill_visited(x, y));
 }
 
-static int test_pixel_not_bg_col(screen_mode_t *screen, int x, int y) {
-   // No need to explicitely test for the marker as the test succeed fail on marked bits anyway
-   return get_pixel(screen, x, y) != g_bg_col;
+static inline __attribute__((always_inline)) int fill_scan_left_bpp(const fill_test_t *test, const uint8_t *row, int x, int y, int log2bpp) {
+   while (x > g_x_min && fill_inside(test, row, x - 1, y, log2bpp)) {
+      x--;
+   }
+   return x;
 }
 
-static int test_pixel_not_bg_ecf(screen_mode_t *screen, int x, int y) {
-   // No need to explicitely test for the marker as the test succeed fail on marked bits anyway
-   int ecfnum = (g_bg_plotmode >> 4) - 1;
-   // Giant ECF
-   if (ecfnum >= 4) {
-      ecfnum = ((x - g_ecf_origin_x) >> g_ecf_giant_shift) & 3;
+static inline __attribute__((always_inline)) int fill_scan_right_bpp(const fill_test_t *test, const uint8_t *row, int x, int y, int log2bpp) {
+   while (x < g_x_max && fill_inside(test, row, x + 1, y, log2bpp)) {
+      x++;
    }
-   pixel_t colour = g_ecf_pattern[ecfnum][(((y - g_ecf_origin_y) & 7) << 3) + ((x - g_ecf_origin_x) & g_ecf_mask)];
-   return get_pixel(screen, x, y) != colour;
+   return x;
 }
 
-static int test_pixel_fg_col(screen_mode_t *screen, int x, int y) {
-   pixel_t px = get_pixel(screen, x, y);
-   if (px & marker) {
-      // terminate the fill if a marked pixel is found
-      return 1;
-   } else {
-      // or at a FG pixel
-      return px == g_fg_col;
+// Returns the leftmost fillable pixel of the run ending at x
+static int fill_scan_left(const fill_test_t *test, const uint8_t *row, int x, int y, int log2bpp) {
+   switch (log2bpp) {
+   case 4:
+      return fill_scan_left_bpp(test, row, x, y, 4);
+   case 5:
+      return fill_scan_left_bpp(test, row, x, y, 5);
+   default:
+      return fill_scan_left_bpp(test, row, x, y, 3);
    }
 }
 
-static int test_pixel_fg_ecf(screen_mode_t *screen, int x, int y) {
-   pixel_t px = get_pixel(screen, x, y);
-   if (px & marker) {
-      // terminate the fill if a marked pixel is found
-      return 1;
-   } else {
-      int ecfnum = (g_fg_plotmode >> 4) - 1;
-      // Giant ECF
-      if (ecfnum >= 4) {
-         ecfnum = ((x - g_ecf_origin_x) >> g_ecf_giant_shift) & 3;
+// Returns the rightmost fillable pixel of the run starting at x
+static int fill_scan_right(const fill_test_t *test, const uint8_t *row, int x, int y, int log2bpp) {
+   switch (log2bpp) {
+   case 4:
+      return fill_scan_right_bpp(test, row, x, y, 4);
+   case 5:
+      return fill_scan_right_bpp(test, row, x, y, 5);
+   default:
+      return fill_scan_right_bpp(test, row, x, y, 3);
+   }
+}
+
+static void fill_mark_visited(int x1, int x2, int y) {
+   uint32_t *row = flood_visited + (y - g_y_min) * flood_visited_pitch;
+   for (int x = x1 - g_x_min; x <= x2 - g_x_min; x++) {
+      row[x >> 5] |= 1u << (x & 31);
+   }
+}
+
+static int fill_init_visited() {
+   flood_visited_pitch = (g_x_max - g_x_min + 32) >> 5;
+   size_t size = (size_t)(flood_visited_pitch * (g_y_max - g_y_min + 1)) * sizeof(uint32_t);
+   if (size > flood_visited_size) {
+      free(flood_visited);
+      flood_visited = malloc(size);
+      flood_visited_size = flood_visited ? size : 0;
+      if (!flood_visited) {
+         return FALSE;
+      }
+   }
+   memset(flood_visited, 0, size);
+   return TRUE;
+}
+
+// Push a span onto the fill stack, growing the stack if necessary
+// Returns FALSE if memory is exhausted
+static int fill_push(int x1, int x2, int y, int dy) {
+   if (y < g_y_min || y > g_y_max) {
+      return TRUE;
+   }
+   if (flood_stack_ptr == flood_stack_size) {
+      int size = flood_stack_size ? flood_stack_size * 2 : FLOOD_STACK_INITIAL;
+      flood_span_t *tmp = realloc(flood_stack, (size_t)size * sizeof(flood_span_t));
+      if (!tmp) {
+         return FALSE;
       }
-      pixel_t colour = g_ecf_pattern[ecfnum][(((y - g_ecf_origin_y) & 7) << 3) + ((x - g_ecf_origin_x) & g_ecf_mask)];
-      // of at a pixel that matches the ECF pattern
-      return (px == colour);
+      flood_stack = tmp;
+      flood_stack_size = size;
    }
+   flood_span_t *span = flood_stack + flood_stack_ptr++;
+   span->x1 = (int16_t)x1;
+   span->x2 = (int16_t)x2;
+   span->y  = (int16_t)y;
+   span->dy = (int16_t)dy;
+   return TRUE;
 }
 
-static void prim_flood_fill(screen_mode_t *screen, int x, int y, plotcol_t fill, fill_test_fn test_pixel) {
+static void prim_flood_fill(screen_mode_t *screen, int x, int y, plotcol_t fill, const fill_test_t *test) {
 #ifdef DEBUG_VDU
    int maxq = 0;
    printf("Flood fill @ %d,%d with fill %d; initial pixel %"PRIx32"\r\n", x, y, fill, get_pixel(screen, x, y));
 #endif
-   if ((*test_pixel)(screen, x, y)) {
+   int log2bpp = screen->log2bpp;
+   if (x < g_x_min || x > g_x_max || y < g_y_min || y > g_y_max) {
       return;
    }
-   flood_queue_x[0] = (int16_t)x;
-   flood_queue_y[0] = (int16_t)y;
-   flood_queue_rd = 0;
-   flood_queue_wr = 1;
-   while (flood_queue_rd != flood_queue_wr) {
-
-      x = flood_queue_x[flood_queue_rd];
-      y = flood_queue_y[flood_queue_rd];
-      flood_queue_rd ++;
-      flood_queue_rd &= FLOOD_QUEUE_SIZE - 1;
-
-      if ((*test_pixel)(screen, x, y)) {
-         continue;
-      }
-
-      int xl = x;
-      int xr = x;
-      while (xl > g_x_min && !(*test_pixel)(screen, xl - 1, y)) {
-         xl--;
-      }
-      while (xr < g_x_max && !(*test_pixel)(screen, xr + 1, y)) {
-         xr++;
+   if (test->visited && !fill_init_visited()) {
+      printf("Flood fill: out of memory\r\n");
+      return;
+   }
+   if (!fill_inside(test, get_fb_row(screen, y), x, y, log2bpp)) {
+      return;
+   }
+   flood_stack_ptr = 0;
+   int ok = fill_push(x, x, y, 1) && fill_push(x, x, y - 1, -1);
+   while (ok && flood_stack_ptr > 0) {
+      // Pop a span; the row y - dy between x1 and x2 has already been filled
+      flood_span_t *span = flood_stack + --flood_stack_ptr;
+      int x1 = span->x1;
+      int x2 = span->x2;
+      int dy = span->dy;
+      y = span->y;
+      const uint8_t *row = get_fb_row(screen, y);
+      // Extend the first run leftwards, the overhang needs checking in the other direction
+      x = x1;
+      if (fill_inside(test, row, x1, y, log2bpp)) {
+         x = fill_scan_left(test, row, x1, y, log2bpp);
+         if (x < x1) {
+            ok = fill_push(x, x1 - 1, y - dy, -dy);
+         }
       }
-      for (x = xl; x <= xr; x++) {
-         set_pixel(screen, x, y, fill);
-         if (y > g_y_min && !(*test_pixel)(screen, x, y - 1)) {
-            flood_queue_x[flood_queue_wr] = (int16_t)x;
-            flood_queue_y[flood_queue_wr] = (int16_t)(y - 1);
-            flood_queue_wr ++;
-            flood_queue_wr &= FLOOD_QUEUE_SIZE - 1;
-#ifdef DEBUG_VDU
-            if (flood_queue_wr == flood_queue_rd) {
-               printf("queue wrapped\r\n");
+      while (ok && x1 <= x2) {
+         if (fill_inside(test, row, x1, y, log2bpp)) {
+            int xr = fill_scan_right(test, row, x1, y, log2bpp);
+            draw_hline(screen, x, xr, y, fill);
+            if (test->visited) {
+               fill_mark_visited(x, xr, y);
             }
-#endif
-         }
-         if (y < g_y_max && !(*test_pixel)(screen, x, y + 1)) {
-            flood_queue_x[flood_queue_wr] = (int16_t)x;
-            flood_queue_y[flood_queue_wr] = (int16_t)(y + 1);
-            flood_queue_wr ++;
-            flood_queue_wr &= FLOOD_QUEUE_SIZE - 1;
-#ifdef DEBUG_VDU
-            if (flood_queue_wr == flood_queue_rd) {
-               printf("queue wrapped\r\n");
+            ok = fill_push(x, xr, y + dy, dy);
+            if (ok && xr > x2) {
+               ok = fill_push(x2 + 1, xr, y - dy, -dy);
             }
-#endif
+            x1 = xr + 1;
+         }
+         // Skip over the boundary to the start of the next run
+         x1++;
+         while (x1 <= x2 && !fill_inside(test, row, x1, y, log2bpp)) {
+            x1++;
          }
+         x = x1;
       }
 #ifdef DEBUG_VDU
-      int size = (FLOOD_QUEUE_SIZE + flood_queue_wr - flood_queue_rd) & (FLOOD_QUEUE_SIZE - 1);
-      if (size > maxq) {
-         maxq = size;
+      if (flood_stack_ptr > maxq) {
+         maxq = flood_stack_ptr;
       }
 #endif
    }
+   if (!ok) {
+      printf("Flood fill: out of memory\r\n");
+   }
 #ifdef DEBUG_VDU
-   printf("Max queue size = %d\r\n", maxq);
+   printf("Max stack size = %d\r\n", maxq);
 #endif
 }
 
-// Return false for pixels that are marked
-static int test_pixel_marker(screen_mode_t *screen, int x, int y) {
-   return !(get_pixel(screen, x, y) & marker);
-}
-
 static void prim_flood_fill_wrapper(screen_mode_t *screen, int x, int y, plotcol_t colour, fill_t mode) {
 
+   fill_test_t test;
+   if (mode == AF_TOFGD) {
+      // Fill up to the foreground colour/pattern
+      test.stop   = FT_STOP_EQ;
+      test.colour = g_fg_col;
+      test.ecf    = g_fg_plotmode;
+      test.marker = marker;
+   } else {
+      // Fill over the background colour/pattern
+      test.stop   = FT_STOP_NE;
+      test.colour = g_bg_col;
+      test.ecf    = g_bg_plotmode;
+      test.marker = 0;
+   }
+
    // Are we in a low colour mode, with a spare bit in the frame buffer?
    if (screen->ncolour < 128) {
 
       // Yes, then we can use a two pass fill, using a marker bit, that is much better
       // at dealing with patterns that contain colours that are themselves fillable
 
-      // Pass 1: Fill the region with a marker
+      // Pass 1: Fill the region with a marker (which itself forms a boundary)
+      test.visited = FALSE;
       if (mode == AF_TOFGD) {
-         // Use the BG colour to fill, because the test_pixel fn uses the FG colour
+         // Use the BG colour to fill, because the test uses the FG colour
          pixel_t old_col = g_bg_col;
          plotmode_t old_plotmode = g_bg_plotmode;
          g_bg_col = marker;
          g_bg_plotmode = PM_XOR;
-         prim_flood_fill(screen, x, y, PC_BG, g_fg_plotmode < PM_ECF ? test_pixel_fg_col : test_pixel_fg_ecf);
+         prim_flood_fill(screen, x, y, PC_BG, &test);
          g_bg_col = old_col;
          g_bg_plotmode = old_plotmode;
       } else {
-         // Use the FG colour to fill, because the test_pixel fn uses the BG colour
+         // Use the FG colour to fill, because the test uses the BG colour
          pixel_t old_col = g_fg_col;
          plotmode_t old_plotmode = g_fg_plotmode;
          g_fg_col = marker;
          g_fg_plotmode = PM_XOR;
-         prim_flood_fill(screen, x, y, PC_FG, g_bg_plotmode < PM_ECF ? test_pixel_not_bg_col : test_pixel_not_bg_ecf);
+         prim_flood_fill(screen, x, y, PC_FG, &test);
          g_fg_col = old_col;
          g_fg_plotmode = old_plotmode;
       }
 
       // Pass 2: Replace the marker with the required colour/pattern
-      prim_flood_fill(screen, x, y, colour, test_pixel_marker);
+      fill_test_t unmarked = { .stop = FT_STOP_UNMARKED, .visited = FALSE };
+      prim_flood_fill(screen, x, y, colour, &unmarked);
 
    } else {
 
-      // No, then well do our best...
-
-      if (mode == AF_TOFGD) {
-         prim_flood_fill(screen, x, y, colour, g_fg_plotmode < PM_ECF ? test_pixel_fg_col : test_pixel_fg_ecf);
-      } else {
-         prim_flood_fill(screen, x, y, colour, g_bg_plotmode < PM_ECF ? test_pixel_not_bg_col : test_pixel_not_bg_ecf);
-      }
+      // No, then well do our best, tracking the filled pixels so nothing is filled twice
+      test.visited = TRUE;
+      prim_flood_fill(screen, x, y, colour, &test);
    }
 }
 
@@ -1193,38 +1718,9 @@ void prim_fill_area(screen_mode_t *screen, int x, int y, plotcol_t colour, fill_
 }
 
 void prim_fill_triangle(screen_mode_t *screen, int x1, int y1, int x2, int y2, int x3, int y3, plotcol_t colour) {
-   int tmp;
-   // Use Standard Triangle Fill
-   // http://www.sunshine2k.de/coding/java/TriangleRasterization/TriangleRasterization.html
-   // sort the three vertices by y-coordinate ascending so v1 is the topmost vertice
-   if (y2 > y1) {
-      tmp = x1; x1 = x2; x2 = tmp;
-      tmp = y1; y1 = y2; y2 = tmp;
-   }
-   if (y3 > y1) {
-      tmp = x1; x1 = x3; x3 = tmp;
-      tmp = y1; y1 = y3; y3 = tmp;
-   }
-   if (y3 > y2) {
-      tmp = x2; x2 = x3; x3 = tmp;
-      tmp = y2; y2 = y3; y3 = tmp;
-   }
-   // here we know that y1 >= y2 >= y3
-   if (y2 == y3) {
-      // trivial case of bottom-flat triangle
-      fill_bottom_flat_triangle(screen, x1, y1, x2, y2, x3, y3, colour);
-   } else if (y1 == y2) {
-      // trivial case of top-flat triangle
-      fill_top_flat_triangle(screen, x1, y1, x2, y2, x3, y3, colour);
-   } else {
-      // general case - split the triangle in a topflat and bottom-flat one
-      int x4 = (int)((float)x1 + ((float)(y1 - y2) / (float)(y1 - y3)) * (float)(x3 - x1));
-      int y4 = y2;
-      fill_bottom_flat_triangle(screen, x1, y1, x2, y2, x4, y4, colour);
-      fill_top_flat_triangle(screen, x2, y2, x4, y4, x3, y3, colour);
-      // draw the overlapping line again, incase we are XOR plotting
-      draw_hline(screen, x2, x4, y4, colour);
-   }
+   const int xs[] = {x1, x2, x3};
+   const int ys[] = {y1, y2, y3};
+   fill_convex_polygon(screen, xs, ys, 3, colour);
 }
 
 // Rodders: Draw arc using modified Bresenham algorithm
@@ -1232,16 +1728,117 @@ void prim_fill_triangle(screen_mode_t *screen, int x1, int y1, int x2, int y2, i
 
 // TODO: Update this to work with non-square pixels
 
-void prim_draw_arc(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2, int y2, plotcol_t colour) {
-   // Draw arc using modified Bresenham algorithm
-   // Finds start and end quadrants and masks plotting of points
+// The arc runs anticlockwise from x1,y1 to where the line from the centre
+// to x2,y2 meets the circle, which is returned in x3,y3
+static int arc_end_point(int xc, int yc, int x1, int y1, int x2, int y2, int *x3, int *y3) {
    int radius = calc_radius(xc, yc, x1, y1);
    // Don't use calc_radius for r2 as this rounds up and can lead to gaps and leakage
    int r2 = (int)sqrt((x2-xc)*(x2-xc) + (y2-yc)*(y2-yc));
+   if (r2 == 0) {
+      // No direction, so end where the arc starts
+      *x3 = x1;
+      *y3 = y1;
+   } else {
+      *x3 = xc + (x2 - xc) * radius / r2;
+      *y3 = yc + (y2 - yc) * radius / r2;
+   }
+   return radius;
+}
+
+// Floor of a / b, for b > 0
+static inline int floor_div(int a, int b) {
+   return (a >= 0) ? (a / b) : -((b - 1 - a) / b);
+}
+
+// Restrict xl..xr to the values of x satisfying a * x <= b
+static void clip_half_plane(int a, int b, int *xl, int *xr) {
+   if (a > 0) {
+      *xr = min(*xr, floor_div(b, a));
+   } else if (a < 0) {
+      *xl = max(*xl, -floor_div(b, -a));
+   } else if (b < 0) {
+      *xr = *xl - 1;
+   }
+}
+
+// Fill the part of a circle bounded by an arc and either the chord between
+// its ends, or the two radii to its ends. Each row of the circle is clipped
+// to the line(s) analytically, so every pixel is plotted exactly once.
+static void fill_arc_segment(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2, int y2, plotcol_t colour, int sector) {
+   int x3, y3;
+   int radius = arc_end_point(xc, yc, x1, y1, x2, y2, &x3, &y3);
+   int yb, yt;
+   if (!span_reset_rows(yc, radius, &yb, &yt)) {
+      return;
+   }
+   span_add_circle(xc, yc, radius);
+
+   // The arc end points, relative to the centre
+   int sx = x1 - xc;
+   int sy = y1 - yc;
+   int ex = x3 - xc;
+   int ey = y3 - yc;
+   int cross = sx * ey - sy * ex;
+   if (cross == 0 && sx * ex + sy * ey > 0) {
+      // The arc ends where it starts, so it's a complete circle
+      span_fill(screen, yb, yt, colour);
+      return;
+   }
+   // A sector of more than 180 degrees is the union of two half planes, rather than the intersection
+   int reflex = sector && cross < 0;
+
+   for (int y = yb; y <= yt; y++) {
+      if (span_xl[y] > span_xr[y]) {
+         continue;
+      }
+      int dy = y - yc;
+      // Work relative to the centre
+      int xl = span_xl[y] - xc;
+      int xr = span_xr[y] - xc;
+      if (sector) {
+         // Points anticlockwise of the start radius: sx * dy - sy * x >= 0
+         int al = xl;
+         int ar = xr;
+         clip_half_plane(sy, sx * dy, &al, &ar);
+         // Points clockwise of the end radius: x * ey - dy * ex >= 0
+         int bl = xl;
+         int br = xr;
+         clip_half_plane(-ey, -ex * dy, &bl, &br);
+         if (reflex) {
+            if (al > ar) {
+               al = bl;
+               ar = br;
+            } else if (bl <= br) {
+               if (bl <= ar + 1 && al <= br + 1) {
+                  // The two parts overlap, so merge them
+                  al = min(al, bl);
+                  ar = max(ar, br);
+               } else {
+                  draw_hline(screen, xc + bl, xc + br, y, colour);
+               }
+            }
+         } else {
+            al = max(al, bl);
+            ar = min(ar, br);
+         }
+         if (al <= ar) {
+            draw_hline(screen, xc + al, xc + ar, y, colour);
+         }
+      } else {
+         // Points on the arc side of the chord: (ex - sx) * (dy - sy) - (ey - sy) * (x - sx) <= 0
+         clip_half_plane(-(ey - sy), -(ex - sx) * (dy - sy) - (ey - sy) * sx, &xl, &xr);
+         if (xl <= xr) {
+            draw_hline(screen, xc + xl, xc + xr, y, colour);
+         }
+      }
+   }
+}
 
-   // Calc end point
-   int x3 = xc + (x2 - xc) * radius / r2;
-   int y3 = yc + (y2 - yc) * radius / r2;
+void prim_draw_arc(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2, int y2, plotcol_t colour) {
+   // Draw arc using modified Bresenham algorithm
+   // Finds start and end quadrants and masks plotting of points
+   int x3, y3;
+   int radius = arc_end_point(xc, yc, x1, y1, x2, y2, &x3, &y3);
 
    // Set up quadrants
    unsigned int qstart = arc_quadrant(x1 - xc, y1 - yc);
@@ -1308,80 +1905,14 @@ void prim_draw_arc(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2
          set_pixel(screen, xc - y, yc - x, colour);
       }
    }
-   // Save the screen coordinates of the arc endpoint, for sector/chord drawing
-   // (but don't reuse the graphics cursor for this purpose)
-   arc_end_x = (int16_t)x3;
-   arc_end_y = (int16_t)y3;
-
-   // Find chord centre for flood fill
-   int xf = (x1 + x3) / 2;
-   int yf = (y1 + y3) / 2;
-
-   // Make xf,yf relative to the centre
-   xf -= xc;
-   yf -= yc;
-
-   // If chord passes through origin use alternative centre
-   if (abs(xf) < 5 && abs(yf) < 5) {
-      xf = -(y1 - yc) / 2;
-      yf =  (x1 - xc) / 2;
-   }
-   unsigned int qf = arc_quadrant(xf, yf);
-   int rf = calc_radius(0, 0, xf, yf);
-   if (rf < 5) rf = radius / 2;
-   xf = (xf + xf * radius / rf) / 2;
-   yf = (yf + yf * radius / rf) / 2;
-
-   // Invert if the point would not be displayed
-   if (!arc_point(qf, q[qf], xc + xf, yc + yf, x1, y1, x3, y3)) {
-      xf = - xf;
-      yf = - yf;
-   }
-
-   // Make xf,yf absolute again
-   xf += xc;
-   yf += yc;
-
-   arc_fill_x = (int16_t)xf;
-   arc_fill_y = (int16_t)yf;
-}
-
-// Common to prim_fill_chord and prim_fill_sector
-static void prim_fill_interior(screen_mode_t *screen, int x, int y, plotcol_t colour) {
-   fill_test_fn test_pixel;
-   if (colour == PC_BG) {
-      if (g_bg_plotmode < PM_ECF) {
-         test_pixel = test_pixel_bg_col;
-      } else {
-         test_pixel = test_pixel_bg_ecf;
-      }
-   } else {
-      if (g_fg_plotmode < PM_ECF) {
-         test_pixel = test_pixel_fg_col;
-      } else {
-         test_pixel = test_pixel_fg_ecf;
-      }
-   }
-   prim_flood_fill(screen, arc_fill_x, arc_fill_y, colour, test_pixel);
 }
 
 void prim_fill_chord(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2, int y2, plotcol_t colour) {
-   // Draw the arc that bounds the chord
-   prim_draw_arc(screen, xc, yc, x1, y1, x2, y2, colour);
-   // The arc drawing sets the arc_end_x/y to the arc endpoint (in screen coordinates)
-   prim_draw_line(screen, x1, y1, arc_end_x, arc_end_y, colour, 0);
-   // Fill the interior
-   prim_fill_interior(screen, arc_fill_x, arc_fill_y, colour);
+   fill_arc_segment(screen, xc, yc, x1, y1, x2, y2, colour, FALSE);
 }
 
 void prim_fill_sector(screen_mode_t *screen, int xc, int yc, int x1, int y1, int x2, int y2, plotcol_t colour) {
-   // Draw the arc that bounds the sector
-   prim_draw_arc(screen, xc, yc, x1, y1, x2, y2, colour);
-   // The arc drawing sets the arc_end_x/y to the arc endpoint (in screen coordinates)
-   prim_draw_line(screen, arc_end_x, arc_end_y, xc, yc, colour, 0);
-   prim_draw_line(screen, xc, yc, x1, y1, colour, 0);
-   // Fill the interior
-   prim_fill_interior(screen, arc_fill_x, arc_fill_y, colour);
+   fill_arc_segment(screen, xc, yc, x1, y1, x2, y2, colour, TRUE);
 }
 
 // Block Copy/Move
@@ -1399,38 +1930,57 @@ void prim_move_copy_rectangle(screen_mode_t *screen, int x1, int y1, int x2, int
       y2 = tmp;
    }
 
-   // Work out direction to copy in taking account of overlap of source and destination rectangles
-   int x_overlap = x3 >= x1 && x3 <= x2;
-   int y_overlap = y3 >= y1 && y3 <= y2;
-   int xstart = x_overlap ?     x2 :     x1;
-   int ystart = y_overlap ?     y2 :     y1;
-   int xend   = x_overlap ? x1 - 1 : x2 + 1;
-   int yend   = y_overlap ? y1 - 1 : y2 + 1;
-   int xstep  = x_overlap ?     -1 :      1;
-   int ystep  = y_overlap ?     -1 :      1;
-
    // Work out the offset between the source and destination rectangles
    int ox = x3 - x1;
    int oy = y3 - y1;
 
-   // Copy/Move a pixel at a time (slow.......)
-   int dy = ystart + oy;
-   for (int sy = ystart; sy != yend; sy += ystep, dy += ystep) {
-      int dx = xstart + ox;
-      for (int sx = xstart; sx != xend; sx += xstep, dx += xstep) {
-         // Default to a background colour pixel
-         pixel_t px = g_bg_col;
-         // Read source pixel, clipping if necessary
-         if (sx >= g_x_min && sx <= g_x_max && sy >= g_y_min && sy <= g_y_max) {
-            px = screen->get_pixel(screen, sx, sy);
-            // If moving, set the source pixal back to the background colour
-            if (move) {
-               set_pixel(screen, sx, sy, PC_BG);
-            }
+   // The destination, clipped to the graphics window
+   int dx1 = max(x1 + ox, g_x_min);
+   int dx2 = min(x2 + ox, g_x_max);
+   int dy1 = max(y1 + oy, g_y_min);
+   int dy2 = min(y2 + oy, g_y_max);
+
+   if (dx1 <= dx2 && dy1 <= dy2) {
+      // Parts of the source outside the graphics window read as the background colour
+      int sx1 = max(dx1 - ox, g_x_min);
+      int sx2 = min(dx2 - ox, g_x_max);
+      int shift = screen->log2bpp - 3;
+      // Copy whole rows, working away from the destination so overlapping rows are read before they are overwritten
+      int ystep = (oy > 0) ? -1 : 1;
+      int ystart = (oy > 0) ? dy2 : dy1;
+      int yend   = (oy > 0) ? dy1 - 1 : dy2 + 1;
+      for (int dy = ystart; dy != yend; dy += ystep) {
+         int sy = dy - oy;
+         if (sy < g_y_min || sy > g_y_max || sx1 > sx2) {
+            fill_row(screen, dx1, dx2, dy, g_bg_col);
+            continue;
+         }
+         // memmove copes with the source and destination overlapping within the row
+         memmove(get_fb_row(screen, dy) + ((sx1 + ox) << shift),
+                 get_fb_row(screen, sy) + (sx1 << shift),
+                 (size_t)(sx2 - sx1 + 1) << shift);
+         if (sx1 + ox > dx1) {
+            fill_row(screen, dx1, sx1 + ox - 1, dy, g_bg_col);
+         }
+         if (sx2 + ox < dx2) {
+            fill_row(screen, sx2 + ox + 1, dx2, dy, g_bg_col);
          }
-         // Write destination pixel, clipping if necessary
-         if (dx >= g_x_min && dx <= g_x_max && dy >= g_y_min && dy <= g_y_max) {
-            screen->set_pixel(screen, dx, dy, px);
+      }
+      mark_dirty(screen, dx1, dx2, dy1, dy2);
+   }
+
+   // If moving, clear the part of the source that the destination doesn't cover
+   if (move) {
+      for (int y = max(y1, g_y_min); y <= min(y2, g_y_max); y++) {
+         if (y < y1 + oy || y > y2 + oy) {
+            draw_hline(screen, x1, x2, y, PC_BG);
+         } else {
+            if (x1 < x1 + ox) {
+               draw_hline(screen, x1, min(x2, x1 + ox - 1), y, PC_BG);
+            }
+            if (x2 > x2 + ox) {
+               draw_hline(screen, max(x1, x2 + ox + 1), x2, y, PC_BG);
+            }
          }
       }
    }
@@ -1451,9 +2001,10 @@ void prim_fill_rectangle(screen_mode_t *screen, int x1, int y1, int x2, int y2,
 void prim_fill_parallelogram(screen_mode_t *screen, int x1, int y1, int x2, int y2, int x3, int y3, plotcol_t colour) {
    int x4 = x3 - x2 + x1;
    int y4 = y3 - y2 + y1;
-   // Fill the parallelogram
-   prim_fill_triangle(screen, x1, y1, x2, y2, x3, y3, colour);
-   prim_fill_triangle(screen, x1, y1, x4, y4, x3, y3, colour);
+   // Fill the parallelogram as a single polygon, so the diagonal is only plotted once
+   const int xs[] = {x1, x2, x3, x4};
+   const int ys[] = {y1, y2, y3, y4};
+   fill_convex_polygon(screen, xs, ys, 4, colour);
 }
 
 
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "../startup.h"
@@ -25,6 +26,19 @@
 
 unsigned char* fb = NULL;
 
+// When double buffering, fb points to an off-screen buffer in ARM memory,
+// and fb_display points to the buffer allocated by the GPU
+static unsigned char *fb_display = NULL;
+static unsigned char *fb_back = NULL;
+static int double_buffer = 0;
+
+// Dirty region: a dirty x extent for each row, plus the range of dirty rows
+static int16_t *dirty_x1;
+static int16_t *dirty_x2;
+static int dirty_rows = 0;
+static int dirty_y1;
+static int dirty_y2;
+
 // Maximum number of logical colours
 #define NUM_COLOURS 256
 
@@ -42,6 +56,21 @@ typedef struct {
 __attribute__((aligned(64))) static uint32_t palette0_base[PROP_BUFFER_SIZE];
 __attribute__((aligned(64))) static uint32_t palette1_base[PROP_BUFFER_SIZE];
 
+// Flashing colours are just a swap between the two palettes, so cost the same
+// whatever the screen size; the swap is skipped entirely when no entries differ
+static int palette_flash_entries;
+static int palette_mark;
+
+// Nearest colour lookup table for 8bpp modes, indexed by RGB quantised to 5:6:5,
+// filled in lazily and invalidated whenever the (non-flashing) palette changes
+
+#define NEAREST_LUT_SIZE (1 << 16)
+
+static uint8_t  nearest_lut[NEAREST_LUT_SIZE];
+static uint32_t nearest_lut_valid[NEAREST_LUT_SIZE / 32];
+static uint32_t nearest_lut_version;
+static uint32_t palette_version = 1;
+
 // ==========================================================================
 // Screen Mode Definitions
 // ==========================================================================
@@ -751,18 +780,19 @@ static screen_mode_t screen_modes[] = {
 // ==========================================================================
 
 static void update_palette(screen_mode_t *screen, int mark) {
-   static int last_mark = 0;
    if (mark < 0) {
-      mark = last_mark;
+      mark = palette_mark;
    }
    uint32_t *pt = mark ? palette0_base : palette1_base;
    // These are overwritten by the previous response
    pt[1] = 0;
    pt[4] = 0;
+#ifndef FB_HEADLESS
    // Don't block waiting for the response
    RPI_Mailbox0Write( MB0_TAGS_ARM_TO_VC, pt );
+#endif
    // Remember the currently selected palette
-   last_mark = mark;
+   palette_mark = mark;
 }
 
 static void init_colour_table(screen_mode_t *screen) {
@@ -860,6 +890,8 @@ static void init_colour_table(screen_mode_t *screen) {
    }
 }
 
+#ifndef FB_HEADLESS
+
 static int get_hdisplay() {
 #ifdef RPI4
    return  ((*PIXELVALVE2_HORZB) & 0xFFFF) * 2;
@@ -872,6 +904,8 @@ static int get_vdisplay() {
     return (*PIXELVALVE2_VERTB) & 0xFFFF;
 }
 
+#endif
+
 static void to_rectangle(screen_mode_t *screen, t_clip_window_t *text_window, rectangle_t *r) {
    if (text_window == NULL) {
       r->x1 = 0;
@@ -896,12 +930,107 @@ static int is_full_screen(screen_mode_t *screen, rectangle_t *r) {
 static void null_handler() {
 }
 
+static void clear_dirty() {
+   for (int y = 0; y < dirty_rows; y++) {
+      dirty_x1[y] = INT16_MAX;
+      dirty_x2[y] = -1;
+   }
+   dirty_y1 = dirty_rows;
+   dirty_y2 = -1;
+}
+
+// On single core builds the flip runs from the vsync interrupt, so the row's
+// extent and the range of dirty rows must be updated with IRQs masked, or a
+// flip landing in between could leave a dirty row outside the range
+#ifdef FB_HEADLESS
+#define DIRTY_LOCK()
+#define DIRTY_UNLOCK()
+#else
+#define DIRTY_LOCK()   int cpsr = _disable_interrupts()
+#define DIRTY_UNLOCK() _set_interrupts(cpsr)
+#endif
+
+static inline void dirty_span(int x1, int x2, int y) {
+   // The pixels must be written before they are marked dirty, as the
+   // flip on vsync may happen at any time
+   DIRTY_LOCK();
+   if (x1 < dirty_x1[y]) {
+      dirty_x1[y] = (int16_t)x1;
+   }
+   if (x2 > dirty_x2[y]) {
+      dirty_x2[y] = (int16_t)x2;
+   }
+   if (y < dirty_y1) {
+      dirty_y1 = y;
+   }
+   if (y > dirty_y2) {
+      dirty_y2 = y;
+   }
+   DIRTY_UNLOCK();
+}
+
+static void init_double_buffer(screen_mode_t *screen) {
+   fb_display = fb;
+   free(fb_back);
+   fb_back = NULL;
+   if (!double_buffer) {
+      return;
+   }
+   fb_back = malloc((size_t)(screen->height * screen->pitch));
+   if (dirty_rows < screen->height) {
+      free(dirty_x1);
+      free(dirty_x2);
+      dirty_x1 = malloc((size_t)screen->height * sizeof(int16_t));
+      dirty_x2 = malloc((size_t)screen->height * sizeof(int16_t));
+   }
+   if (!fb_back || !dirty_x1 || !dirty_x2) {
+      printf("Double buffer: out of memory\r\n");
+      free(fb_back);
+      fb_back = NULL;
+      double_buffer = 0;
+      return;
+   }
+   dirty_rows = screen->height;
+   clear_dirty();
+   // Start with a copy of the visible screen
+   memcpy(fb_back, fb_display, (size_t)(screen->height * screen->pitch));
+   fb = fb_back;
+}
+
 // ==========================================================================
 // Default handlers
 // ==========================================================================
 
 // These are non static so it can be called by custom modes
 
+#ifdef FB_HEADLESS
+
+// Headless builds (e.g. for host benchmarks) draw to a frame buffer in memory
+
+static unsigned char *fb_memory = NULL;
+
+void default_init_screen(screen_mode_t *screen) {
+
+    screen->pitch = screen->width << (screen->log2bpp - 3);
+    free(fb_memory);
+    fb_memory = calloc((size_t)(screen->height * screen->pitch), 1);
+    fb = fb_memory;
+
+    // Possibly redirect drawing to an off-screen buffer
+    init_double_buffer(screen);
+
+    // Initialize colour table and palette
+    screen->reset(screen);
+
+    /* Clear the screen to the background colour */
+    screen->clear(screen, NULL, 0);
+
+    /* Make the cleared screen visible */
+    flip_double_buffer(screen);
+}
+
+#else
+
 void default_init_screen(screen_mode_t *screen) {
 
     rpi_mailbox_property_t *mp;
@@ -1006,13 +1135,21 @@ void default_init_screen(screen_mode_t *screen) {
     // On the Pi 2/3 the mailbox returns the address with bits 31..30 set, which is wrong
     fb = (unsigned char *)(((unsigned int) fb) & 0x3fffffff);
 
+    // Possibly redirect drawing to an off-screen buffer
+    init_double_buffer(screen);
+
     // Initialize colour table and palette
     screen->reset(screen);
 
     /* Clear the screen to the background colour */
     screen->clear(screen, NULL, 0);
+
+    /* Make the cleared screen visible */
+    flip_double_buffer(screen);
 }
 
+#endif
+
 void default_reset_screen(screen_mode_t *screen) {
     /* Copy default colour table */
     init_colour_table(screen);
@@ -1054,7 +1191,12 @@ void default_scroll_screen(screen_mode_t *screen, t_clip_window_t *text_window,
       } else if (screen->log2bpp == 4) {
          bg_col = bg_col | (bg_col << 16);
       }
+#ifdef FB_HEADLESS
+      memmove(fb, fb + font_height * screen->pitch, (size_t)((screen->height - font_height) * screen->pitch));
+#else
       _fast_scroll(fb, fb + font_height * screen->pitch, (screen->height - font_height) * screen->pitch);
+#endif
+      mark_dirty(screen, 0, screen->width - 1, 0, screen->height - 1);
       // Now blank the bottom line
       blank = r.y1;
    } else {
@@ -1098,7 +1240,15 @@ void default_scroll_screen(screen_mode_t *screen, t_clip_window_t *text_window,
 
 void default_set_colour_8bpp(screen_mode_t *screen, colour_index_t index, int r, int g, int b) {
    pixel_t *colour_t = ((index & 0x100) ? palette1_base : palette0_base) + PALETTE_DATA_OFFSET;
-   colour_t[index & 0xff] = 0xFF000000 | ((b & 0xFF) << 16) | ((g & 0xFF) << 8) | (r & 0xFF);
+   uint32_t i = index & 0xff;
+   // Keep count of the entries that differ between the two palettes (i.e. that flash)
+   int was_flashing = palette0_base[PALETTE_DATA_OFFSET + i] != palette1_base[PALETTE_DATA_OFFSET + i];
+   colour_t[i] = 0xFF000000 | ((b & 0xFF) << 16) | ((g & 0xFF) << 8) | (r & 0xFF);
+   palette_flash_entries += (palette0_base[PALETTE_DATA_OFFSET + i] != palette1_base[PALETTE_DATA_OFFSET + i]) - was_flashing;
+   // Nearest colour matching only uses the first palette
+   if (!(index & 0x100)) {
+      palette_version++;
+   }
 }
 
 void default_set_colour_16bpp(screen_mode_t *screen, colour_index_t index, int r, int g, int b) {
@@ -1143,16 +1293,16 @@ pixel_t default_get_colour_32bpp(screen_mode_t *screen, uint8_t gcol) {
    return (pixel_t)((b << 16) | (g << 8) | r);
 }
 
-pixel_t default_nearest_colour_8bpp(struct screen_mode *screen, uint8_t r, uint8_t g, uint8_t b) {
+static colour_index_t search_nearest_colour_8bpp(struct screen_mode *screen, int r, int g, int b) {
    // Max distance is 7 * 255 * 255 which fits easily in an int
    int distance = 0x7fffffff;
    colour_index_t best = 0;
    for (colour_index_t i = 0; i <= screen->ncolour && distance != 0; i++) {
       pixel_t colour = palette0_base[i + PALETTE_DATA_OFFSET];
       // xxBBGGRR
-      int dr = r - (colour & 0xff);
-      int dg = g - ((colour >> 8) & 0xff);
-      int db = b - ((colour >> 16) & 0xff);
+      int dr = r - (int)(colour & 0xff);
+      int dg = g - (int)((colour >> 8) & 0xff);
+      int db = b - (int)((colour >> 16) & 0xff);
       int d = 2 * dr * dr + 4 * dg * dg + db * db;
       if (d < distance) {
          distance = d;
@@ -1162,6 +1312,27 @@ pixel_t default_nearest_colour_8bpp(struct screen_mode *screen, uint8_t r, uint8
    return best;
 }
 
+pixel_t default_nearest_colour_8bpp(struct screen_mode *screen, uint8_t r, uint8_t g, uint8_t b) {
+   // Discard the lookup table if the palette has changed since it was built
+   if (nearest_lut_version != palette_version) {
+      memset(nearest_lut_valid, 0, sizeof(nearest_lut_valid));
+      nearest_lut_version = palette_version;
+   }
+   unsigned int i = ((r & 0xF8u) << 8) | ((g & 0xFCu) << 3) | ((b & 0xF8u) >> 3);
+   uint32_t mask = 1u << (i & 31);
+   if (!(nearest_lut_valid[i >> 5] & mask)) {
+      // Match a fixed representative of the quantised cell (its top bits replicated
+      // into the low bits, as when widening 5 or 6 bits to 8), so the result
+      // doesn't depend on the first caller
+      int rq = (r & 0xF8) | (r >> 5);
+      int gq = (g & 0xFC) | (g >> 6);
+      int bq = (b & 0xF8) | (b >> 5);
+      nearest_lut[i] = (uint8_t)search_nearest_colour_8bpp(screen, rq, gq, bq);
+      nearest_lut_valid[i >> 5] |= mask;
+   }
+   return nearest_lut[i];
+}
+
 pixel_t default_nearest_colour_16bpp(struct screen_mode *screen, uint8_t r, uint8_t g, uint8_t b) {
    //                                    15 14 13 12 11 10  9  8  7  6  5  4  3  2  1  0
    // The 16-bit colour number format is R4 R3 R2 R1 R0 G5 G4 G3 G2 G1 G0 B4 B3 B2 B1 B0
@@ -1178,16 +1349,24 @@ pixel_t default_nearest_colour_32bpp(struct screen_mode *screen, uint8_t r, uint
 void default_set_pixel_8bpp(screen_mode_t *screen, int x, int y, pixel_t value) {
    uint8_t *fbptr = (uint8_t *)(fb + (screen->height - y - 1) * screen->pitch + x);
    *fbptr = (uint8_t)value;
+   if (double_buffer) {
+      dirty_span(x, x, y);
+   }
 }
 
 void default_set_pixel_16bpp(screen_mode_t *screen, int x, int y, pixel_t value) {
    uint16_t *fbptr = (uint16_t *)(fb + (screen->height - y - 1) * screen->pitch + x * 2);
    *fbptr = (uint16_t)value;
-
+   if (double_buffer) {
+      dirty_span(x, x, y);
+   }
 }
 void default_set_pixel_32bpp(screen_mode_t *screen, int x, int y, pixel_t value) {
    uint32_t *fbptr = (uint32_t *)(fb + (screen->height - y - 1) * screen->pitch + x * 4);
    *fbptr = value;
+   if (double_buffer) {
+      dirty_span(x, x, y);
+   }
 }
 
 pixel_t default_get_pixel_8bpp(screen_mode_t *screen, int x, int y) {
@@ -1227,7 +1406,12 @@ void default_unknown_vdu(screen_mode_t *screen, uint8_t *buf) {
 }
 
 void default_flash(screen_mode_t *screen, int mark) {
-   update_palette(screen, mark);
+   if (palette_flash_entries) {
+      update_palette(screen, mark);
+   } else {
+      // Nothing would visibly change, so just track the phase
+      palette_mark = mark;
+   }
 }
 
 // ==========================================================================
@@ -1301,6 +1485,7 @@ screen_mode_t *get_screen_mode(int mode_num) {
       if (sm->par == 0.0F) {
          sm->par = ((float) (1 << sm->xeigfactor)) / ((float) (1 << sm->yeigfactor));
       }
+      // Only palette modes have flashing colours; 16/32bpp modes have no flash handler at all
       if (!sm->flash && sm->log2bpp == 3) {
          sm->flash = default_flash;
       }
@@ -1320,9 +1505,123 @@ screen_mode_t *get_screen_mode(int mode_num) {
 }
 
 uint32_t get_fb_address() {
-   return (uint32_t) fb;
+   return (uint32_t) (uintptr_t) fb;
 }
 
+uint32_t get_palette_version() {
+   return palette_version;
+}
+
+uint8_t *get_fb_row(screen_mode_t *screen, int y) {
+   // Row 0 is the bottom of the screen, but the top of the frame buffer
+   return fb + (screen->height - y - 1) * screen->pitch;
+}
+
+uint32_t get_fb_display_address() {
+   return (uint32_t) (uintptr_t) (double_buffer ? fb_display : fb);
+}
+
+int is_double_buffered() {
+   return double_buffer;
+}
+
+void set_double_buffer(screen_mode_t *screen, int enable) {
+   enable = enable ? 1 : 0;
+   if (enable == double_buffer) {
+      return;
+   }
+   if (!enable) {
+      // Make sure the display is up-to-date before drawing to it directly
+      flip_double_buffer(screen);
+   }
+   double_buffer = enable;
+   // The screen may not have been initialized yet (i.e. from the cmdline)
+   if (screen && fb) {
+      if (!double_buffer) {
+         fb = fb_display;
+      }
+      init_double_buffer(screen);
+   }
+}
+
+void mark_dirty(screen_mode_t *screen, int x1, int x2, int y1, int y2) {
+   if (!double_buffer) {
+      return;
+   }
+   for (int y = y1; y <= y2; y++) {
+      dirty_span(x1, x2, y);
+   }
+}
+
+void flip_double_buffer(screen_mode_t *screen) {
+   if (!double_buffer) {
+      return;
+   }
+   int bytes_per_pixel = 1 << (screen->log2bpp - 3);
+   int y2 = dirty_y2;
+   for (int y = dirty_y1; y <= y2; y++) {
+      int x1 = dirty_x1[y];
+      int x2 = dirty_x2[y];
+      if (x1 <= x2) {
+         // Reset the row first, so any concurrent drawing is picked up next time
+         dirty_x1[y] = INT16_MAX;
+         dirty_x2[y] = -1;
+         size_t offset = (size_t)((screen->height - y - 1) * screen->pitch + x1 * bytes_per_pixel);
+         memcpy(fb_display + offset, fb_back + offset, (size_t)((x2 - x1 + 1) * bytes_per_pixel));
+      }
+   }
+   dirty_y1 = dirty_rows;
+   dirty_y2 = -1;
+}
+
+#ifdef FB_HEADLESS
+
+int write_screen_ppm(screen_mode_t *screen, const char *filename) {
+   FILE *f = fopen(filename, "wb");
+   if (!f) {
+      return -1;
+   }
+   fprintf(f, "P6\n%d %d\n255\n", screen->width, screen->height);
+   const pixel_t *palette = palette0_base + PALETTE_DATA_OFFSET;
+   const unsigned char *base = double_buffer ? fb_display : fb;
+   // Row 0 of the frame buffer is the top of the screen
+   for (int y = 0; y < screen->height; y++) {
+      const unsigned char *row = base + y * screen->pitch;
+      for (int x = 0; x < screen->width; x++) {
+         uint8_t rgb[3];
+         uint32_t p;
+         switch (screen->log2bpp) {
+         case 4:
+            // R4..R0 G5..G0 B4..B0
+            p = ((const uint16_t *)row)[x];
+            rgb[0] = (uint8_t)(((p >> 11) & 0x1f) << 3);
+            rgb[1] = (uint8_t)(((p >>  5) & 0x3f) << 2);
+            rgb[2] = (uint8_t)(( p        & 0x1f) << 3);
+            break;
+         case 5:
+            // xxBBGGRR
+            p = ((const uint32_t *)row)[x];
+            rgb[0] = (uint8_t)(p & 0xff);
+            rgb[1] = (uint8_t)((p >> 8) & 0xff);
+            rgb[2] = (uint8_t)((p >> 16) & 0xff);
+            break;
+         default:
+            // Palette entries are xxBBGGRR
+            p = palette[row[x]];
+            rgb[0] = (uint8_t)(p & 0xff);
+            rgb[1] = (uint8_t)((p >> 8) & 0xff);
+            rgb[2] = (uint8_t)((p >> 16) & 0xff);
+            break;
+         }
+         fwrite(rgb, 1, 3, f);
+      }
+   }
+   fclose(f);
+   return 0;
+}
+
+#endif
+
 int32_t fb_read_mode_variable(mode_variable_t v, screen_mode_t *screen) {
    switch (v) {
    case M_MODEFLAGS:
@@ -16,7 +16,7 @@
 struct font;
 
 // Uncomment to use V3D triangle fill in 16bpp and 32bpp modes
-// This is approx 2x-3x faster for random sized triangles
+// This is optional: the software span fill is used by default (see *PITRI)
 // #define USE_V3D
 
 typedef uint32_t pixel_t;
@@ -149,6 +149,29 @@ screen_mode_t *get_screen_mode(int mode_num);
 
 uint32_t get_fb_address();
 
+// Changes whenever the (non-flashing) palette changes, including on a mode change
+uint32_t get_palette_version();
+
+uint8_t *get_fb_row(screen_mode_t *screen, int y);
+
+// Double buffering: when enabled, drawing goes to an off-screen buffer, and
+// the dirty regions are copied to the display by flip_double_buffer()
+
+uint32_t get_fb_display_address();
+
+int is_double_buffered();
+
+void set_double_buffer(screen_mode_t *screen, int enable);
+
+void mark_dirty(screen_mode_t *screen, int x1, int x2, int y1, int y2);
+
+void flip_double_buffer(screen_mode_t *screen);
+
+#ifdef FB_HEADLESS
+// Write the visible screen as a binary PPM file, returns 0 on success
+int write_screen_ppm(screen_mode_t *screen, const char *filename);
+#endif
+
 int32_t fb_read_mode_variable(mode_variable_t v, screen_mode_t *screen);
 
 #endif
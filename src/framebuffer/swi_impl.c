@@ -12,17 +12,6 @@
 
 static SWIHandler_Type base_handler[NUM_SWI_HANDLERS];
 
-// ==========================================================================
-// Static methods
-// ==========================================================================
-
-static void write_string(char *ptr) {
-  char c;
-  while ((c = *ptr++) != 0) {
-     fb_writec(c);
-  }
-}
-
 // ==========================================================================
 // Implementation of SWIs that write to the VDU
 // ==========================================================================
@@ -34,7 +23,7 @@ static void OS_WriteC_impl(unsigned int *reg) {
 static void OS_WriteS_impl(unsigned int *reg) {
    // On exit, the link register should point to the byte after the terminator
    uint32_t r13 = reg[13];
-   write_string((char *)reg[13]);
+   fb_writes((char *)reg[13]);
    // Reg 13 is the stacked link register which points to the string
    reg[13] = r13 + strlen((char *)r13) + 1;
    // Make sure new value of link register is word aligned to the next word boundary
@@ -45,7 +34,7 @@ static void OS_WriteS_impl(unsigned int *reg) {
 static void OS_Write0_impl(unsigned int *reg) {
    // On exit, R0 should point to the byte after the terminator
    uint32_t r0 = reg[0];
-   write_string((char *)reg[0]);
+   fb_writes((char *)reg[0]);
    reg[0] = r0 + strlen((char *)r0) + 1;
 }
 
@@ -65,11 +54,7 @@ static void OS_Plot_impl(unsigned int *reg) {
 }
 
 static void OS_WriteN_impl(unsigned int *reg) {
-   char *ptr = (char *)reg[0];
-   uint32_t len = reg[1];
-   while (len-- > 0) {
-      fb_writec(*ptr++);
-   }
+   fb_writen((char *)reg[0], reg[1]);
 }
 
 // ==========================================================================
@@ -160,8 +145,12 @@ static void OS_Byte_impl(unsigned int *reg) {
 // Implementation of OS_ReadLine SWI
 // ==========================================================================
 
+// Echo through the current OS_WriteC handler directly, rather than by issuing
+// another SWI, so with the Pi VDU each key costs just a call to the VDU driver,
+// and nothing but the OSRDCH itself goes over the Tube
 static inline void writeVDU(uint8_t c) {
-   OS_WriteC((char) c);
+   unsigned int r0 = c;
+   os_table[SWI_OS_WriteC].handler(&r0);
 }
 
 static void OS_ReadLine_impl(unsigned int *reg) {
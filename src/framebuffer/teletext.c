@@ -16,6 +16,7 @@
 // - Added modes 70 (60x25) and 71 (80x25)
 // - Move character rounding to the font code, so it could be used in other modes
 // - Added graphics characters to the SAA fonts to simplify things
+// - Cache the attributes each cell was rendered with, so only changed cells are redrawn
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,6 +32,16 @@
 #define MAX_COLUMNS 80
 #define MAX_ROWS    32
 
+// Marks a cell whose contents on screen are unknown
+#define CELL_INVALID 0xFFFFFFFF
+
+// How each cell is drawn from the glyph rows in the font buffer
+typedef enum {
+   CELL_NORMAL,
+   CELL_DOUBLE_TOP,
+   CELL_DOUBLE_BOTTOM
+} cell_height_t;
+
 // Main structure holding Teletext state
 struct {
 
@@ -64,6 +75,14 @@ struct {
    // Counts of the number of double-height control codes in each
    unsigned int dh_count[MAX_ROWS];
 
+   // The glyph, colours and height each cell was last drawn with, so
+   // re-rendering a row only needs to redraw the cells that have changed
+   uint32_t rendered[MAX_ROWS][MAX_COLUMNS];
+
+   // Expands four bits of a glyph row to four 8bpp pixels, for the colour pair in lut_colours
+   uint32_t lut[16];
+   uint32_t lut_colours;
+
 } tt;
 
 // Screen Mode Handlers
@@ -138,6 +157,21 @@ static screen_mode_t teletext_screen_modes[] = {
    }
 };
 
+static void invalidate_cells(int left, int right, int top, int bottom) {
+   for (int row = top; row <= bottom; row++) {
+      for (int col = left; col <= right; col++) {
+         tt.rendered[row][col] = CELL_INVALID;
+      }
+   }
+}
+
+// Called when something other than the teletext renderer (e.g. CLG, PLOT or
+// VDU 5 text) has drawn into the frame buffer, so the cached cells no longer
+// match what is on the screen
+void tt_invalidate_cache() {
+   invalidate_cells(0, MAX_COLUMNS - 1, 0, MAX_ROWS - 1);
+}
+
 static void set_font(screen_mode_t *screen, int num) {
    // This screen mode always uses the SAA505x family of fonts
    char name[] = "SAA5050";
@@ -145,6 +179,8 @@ static void set_font(screen_mode_t *screen, int num) {
    font_t *font = get_font_by_name(name);
    font->set_rounding(font, TRUE);
    screen->font = font;
+   // The cells on screen were drawn with the old font
+   invalidate_cells(0, MAX_COLUMNS - 1, 0, MAX_ROWS - 1);
 }
 
 screen_mode_t *tt_get_screen_mode(int mode_num) {
@@ -237,6 +273,7 @@ static void tt_reset(screen_mode_t *screen) {
    tt.last_row = -1;
    tt.last_col = -1;
    tt.reveal = 0;
+   tt.lut_colours = CELL_INVALID;
    // Configure the default palette
    initialize_palette(screen);
 }
@@ -259,12 +296,14 @@ static void tt_clear(screen_mode_t *screen, t_clip_window_t *text_window, pixel_
    // Clear the backing store
    if (text_window == NULL) {
       memset(tt.mode7screen, TT_SPACE, sizeof(tt.mode7screen));
+      invalidate_cells(0, MAX_COLUMNS - 1, 0, MAX_ROWS - 1);
    } else {
       for (int row = text_window->top; row <= text_window->bottom; row++) {
          for (int col = text_window->left; col <= text_window->right; col++) {
             tt.mode7screen[row][col] = TT_SPACE;
          }
       }
+      invalidate_cells(text_window->left, text_window->right, text_window->top, text_window->bottom);
    }
    // Recalculate the double height counts
    update_double_height_counts();
@@ -279,24 +318,29 @@ static void tt_scroll(screen_mode_t *screen, t_clip_window_t *text_window, pixel
       for (int row = text_window->top; row < text_window->bottom; row++) {
          for (int col = text_window->left; col <= text_window->right; col++) {
             tt.mode7screen[row][col] = tt.mode7screen[row + 1][col];
+            tt.rendered[row][col] = tt.rendered[row + 1][col];
          }
       }
       for (int col = text_window->left; col <= text_window->right; col++) {
          tt.mode7screen[text_window->bottom][col] = TT_SPACE;
       }
+      invalidate_cells(text_window->left, text_window->right, text_window->bottom, text_window->bottom);
       break;
    case SCROLL_DOWN:
       for (int row = text_window->bottom; row > text_window->top; row--) {
          for (int col = text_window->left; col <= text_window->right; col++) {
             tt.mode7screen[row][col] = tt.mode7screen[row - 1][col];
+            tt.rendered[row][col] = tt.rendered[row - 1][col];
          }
       }
       for (int col = text_window->left; col <= text_window->right; col++) {
          tt.mode7screen[text_window->top][col] = TT_SPACE;
       }
+      invalidate_cells(text_window->left, text_window->right, text_window->top, text_window->top);
       break;
    default:
       // TODO - Left and Right not implemented
+      invalidate_cells(text_window->left, text_window->right, text_window->top, text_window->bottom);
       break;
    }
    // Recalculate the double height counts
@@ -434,7 +478,10 @@ static void tt_process_controls_after(int c, int col, int row) {
 }
 
 // Redraw character c at col, row using the current line state
-static void tt_draw_character(screen_mode_t *screen, int c, int col, int row) {
+//
+// Unless forced, the cell is only redrawn if its glyph, colours or height
+// differ from when it was last drawn
+static void tt_draw_character(screen_mode_t *screen, int c, int col, int row, int force) {
    font_t *font = screen->font;
 
    int xoffset = col * font->get_overall_w(font);
@@ -463,21 +510,50 @@ static void tt_draw_character(screen_mode_t *screen, int c, int col, int row) {
       c &= 0x7f;
    }
 
-   if (tt.doubled) {
+   cell_height_t cell_height = tt.doubled ? (tt.double_bottom ? CELL_DOUBLE_BOTTOM : CELL_DOUBLE_TOP) : CELL_NORMAL;
+   uint32_t attributes = (uint32_t)c | (tt.fgd_colour << 8) | (tt.bgd_colour << 14) | ((uint32_t)cell_height << 20);
+   if (!force && tt.rendered[row][col] == attributes) {
+      return;
+   }
+   tt.rendered[row][col] = attributes;
+
+   int width  = font->width << font->get_rounding(font);
+   int height = font->height << font->get_rounding(font);
+
+   // Double height repeats each row from the top or bottom half of the glyph
+   int dh_shift = (cell_height == CELL_NORMAL) ? 0 : 1;
+   uint16_t *rowp = font->buffer + c * height + ((cell_height == CELL_DOUBLE_BOTTOM) ? (height >> 1) : 0);
+
+   if (screen->log2bpp == 3 && !(width & 3) && font->get_overall_w(font) == width && font->get_overall_h(font) == height) {
+      // Fast path: expand the glyph rows a nibble at a time straight into the frame buffer
+      uint32_t colours = (tt.fgd_colour << 8) | tt.bgd_colour;
+      if (colours != tt.lut_colours) {
+         for (uint32_t i = 0; i < 16; i++) {
+            uint32_t pixels = 0;
+            for (int j = 0; j < 4; j++) {
+               pixels |= ((i & (8 >> j)) ? tt.fgd_colour : tt.bgd_colour) << (j * 8);
+            }
+            tt.lut[i] = pixels;
+         }
+         tt.lut_colours = colours;
+      }
+      for (int y = 0; y < height; y++) {
+         uint32_t data = rowp[y >> dh_shift];
+         uint32_t *fbp = (uint32_t *)(get_fb_row(screen, yoffset - y) + xoffset);
+         for (int shift = width - 4; shift >= 0; shift -= 4) {
+            *fbp++ = tt.lut[(data >> shift) & 15];
+         }
+      }
+      mark_dirty(screen, xoffset, xoffset + width - 1, yoffset - height + 1, yoffset);
+   } else if (tt.doubled) {
       // Use a custom font renderer to render double height
-      int width  = font->width << font->get_rounding(font);
-      int height = font->height << font->get_rounding(font);
-      uint16_t *rowp = font->buffer + c * height + (tt.double_bottom ? (height >> 1) : 0);
       for (int y = 0; y < height; y++) {
-         uint16_t innerrow = *rowp;
+         uint16_t innerrow = rowp[y >> dh_shift];
          int mask = 1 << (width - 1);
          for (int x = 0; x < width; x++) {
             screen->set_pixel(screen, xoffset + x, yoffset - y, (innerrow & mask) ? tt.fgd_colour : tt.bgd_colour);
             mask >>= 1;
          }
-         if (y & 1) {
-            rowp++;
-         }
       }
    } else {
       // Use the standard font renderer to render normal height
@@ -489,7 +565,7 @@ static void re_render_row(screen_mode_t *screen, int col, int row) {
    for (; col < tt.columns; col++) {
       uint8_t tmpc = tt.mode7screen[row][col];
       uint8_t renderc = tt_process_controls(tmpc, col, row);
-      tt_draw_character(screen, renderc, col, row);
+      tt_draw_character(screen, renderc, col, row, FALSE);
       tt_process_controls_after(tmpc, col, row);
    }
 }
@@ -525,9 +601,9 @@ static void tt_write_character(screen_mode_t *screen, int c, int col, int row, p
       }
    }
 
-   // Render the current character
+   // Render the current character (always, in case the glyph has been redefined)
    uint8_t renderc = tt_process_controls(c, col, row);
-   tt_draw_character(screen, renderc, col, row);
+   tt_draw_character(screen, renderc, col, row, TRUE);
    tt_process_controls_after(c, col, row);
 
    // Update the backing store
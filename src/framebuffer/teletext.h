@@ -66,4 +66,6 @@ screen_mode_t *tt_get_screen_mode(int mode_num);
 
 void tt_vdu_23_18(uint8_t *params);
 
+void tt_invalidate_cache();
+
 #endif
@@ -3,6 +3,14 @@
 #include <string.h>
 #include "startup.h"
 #include "performance.h"
+#include "tube-ula.h"
+
+#ifdef DEBUG_FIQ_LATENCY
+// The FIQ latency histogram needs the cycle counter to count every cycle
+#define CYCLE_COUNTER_DIVIDER 1
+#else
+#define CYCLE_COUNTER_DIVIDER 64
+#endif
 
 #if defined(RPI3) || defined(RPI4)
 
@@ -140,7 +148,7 @@ void reset_performance_counters(perf_counters_t *pct) {
    // bit 2 = 1 means reset cycle counter to zero
    // bit 1 = 1 means reset counters to zero
    // bit 0 = 1 enable counters
-   unsigned ctrl = 0x0F;
+   unsigned ctrl = (CYCLE_COUNTER_DIVIDER == 64) ? 0x0F : 0x07;
 
 
 #if defined(RPI2) || defined(RPI3) || defined(RPI4)
@@ -212,7 +220,7 @@ static char* uint64ToDecimal(uint64_t v) {
 void print_performance_counters(const perf_counters_t *pct) {
    int i;
    uint64_t cycle_counter = pct->cycle_counter;
-   cycle_counter *= 64;
+   cycle_counter *= CYCLE_COUNTER_DIVIDER;
    // newlib-nano doesn't appear to support 64-bit printf/scanf on 32-bit systems
    // printf("%26s = %"PRIu64"\r\n", "cycle counter", cycle_counter);
    printf("%26s = %s\r\n", "cycle counter", uint64ToDecimal(cycle_counter));
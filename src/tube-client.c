@@ -131,43 +131,16 @@ static void init_emulator() {
 
 #ifdef HAS_MULTICORE
 
-#if 0
-
-// DMB: This method is no longer ever called, because we only
-// ever run the emulation on the main core.
+// Core 1 is started via _init_core (which sets up its stacks and VFP) and
+// runs the VDU renderer, so graphics output doesn't slow the Co Pro emulation
 
 void run_core() {
-   // Write first line without using printf
-   // In case the VFP unit is not enabled
-#ifdef DEBUG
-   int i;
-   RPI_AuxMiniUartWrite('C');
-   RPI_AuxMiniUartWrite('O');
-   RPI_AuxMiniUartWrite('R');
-   RPI_AuxMiniUartWrite('E');
-   i = _get_core();
-   RPI_AuxMiniUartWrite('0' + i);
-   RPI_AuxMiniUartWrite('\r');
-   RPI_AuxMiniUartWrite('\n');
-#endif
-
-   enable_MMU_and_IDCaches();
+   enable_MMU_and_IDCaches_secondary();
    _enable_unaligned_access();
 
-#ifdef DEBUG
-   LOG_DEBUG("emulator running on core %d\r\n", i);
-#endif
-
-   do {
-      // Run the emulator
-      copro_def->emulator(copro_def->type);
-
-      // Reload the emulator as copro may have changed
-      init_emulator();
-
-   } while (1);
+   // Never returns
+   fb_run_vdu_core();
 }
-#endif
 
 static void start_core(int core, func_ptr func) {
    LOG_DEBUG("starting core %d\r\n", core);
@@ -268,7 +241,14 @@ void kernel_main(unsigned int r0, unsigned int r1, unsigned int atags)
 
 #ifdef HAS_MULTICORE
   LOG_DEBUG("main running on core %u\r\n", _get_core());
-  start_core(1, _spin_core);
+  if (vdu_enabled) {
+     // Hand the VDU over before core 1 starts draining the queue, so the
+     // two cores never render at the same time
+     fb_start_vdu_core(1);
+     start_core(1, _init_core);
+  } else {
+     start_core(1, _spin_core);
+  }
   start_core(2, _spin_core);
   start_core(3, _spin_core);
 #endif
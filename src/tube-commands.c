@@ -15,6 +15,8 @@
 #include "copro-defs.h"
 #include "utils.h"
 #include "programs.h"
+#include "rpi-systimer.h"
+#include "tube-isr.h"
 
 static int doCmdHelp    (const char *params);
 static int doCmdTest    (const char *params);
@@ -25,13 +27,17 @@ static int doCmdFill    (const char *params);
 static int doCmdCrc     (const char *params);
 static int doCmdArmBasic(const char *params);
 static int doCmdPiVDU   (const char *params);
+static int doCmdPiVDUQ  (const char *params);
 static int doCmdPiLIFE  (const char *params);
+static int doCmdPiTRI   (const char *params);
 static int doCmdFX      (const char *params);
+static int doCmdXfers   (const char *params);
+static int doCmdFiqLat  (const char *params);
 
 // Include ARM Basic
 #include "armbasic.h"
 
-// For fb_set_vdu_device (used by *PIVDU)
+// For fb_set_vdu_device (used by *PIVDU) and fb_get_vdu_queue_stats (used by *PIVDUQ)
 #include "framebuffer/framebuffer.h"
 
 static const char *help = "Native ARM Tube Client ("RELEASENAME"/"GITVERSION")\r\n";
@@ -65,13 +71,17 @@ cmd_type cmds[] = {
   { "CRC",      "<start> <end>",                               doCmdCrc,      MODE_USER, 0 },
   { "DIS",      "<address>",                                   doCmdDis,      MODE_USER, 0 },
   { "FILL",     "<start> <end> <data>",                        doCmdFill,     MODE_USER, 0 },
+  { "FIQLAT",   "[ R ]",                                       doCmdFiqLat,   MODE_USER, 0 },
   { "FX",       "<a>, <x>, <y>",                               doCmdFX,       MODE_USER, 1 },
   { "HELP",     "[ <command> ]",                               doCmdHelp,     MODE_USER, 0 },
   { "GO",       "<address>",                                   doCmdGo,       MODE_USER, 0 },
   { "MEM",      "<address>",                                   doCmdMem,      MODE_USER, 0 },
   { "PIVDU",    "<device: 0..3>",                              doCmdPiVDU,    MODE_USER, 1 },
+  { "PIVDUQ",   "[ R ]",                                       doCmdPiVDUQ,   MODE_USER, 1 },
   { "PILIFE",   "[ <generations> [ <x size> [ <y size> ] ] ]", doCmdPiLIFE,   MODE_USER, 1 },
+  { "PITRI",    "[ <triangles> ]",                             doCmdPiTRI,    MODE_USER, 1 },
   { "TEST",     "",                                            doCmdTest,     MODE_USER, 0 },
+  { "XFERS",    "[ R ]",                                       doCmdXfers,    MODE_USER, 0 },
 };
 
 #define NUM_CMDS (sizeof(cmds) / sizeof(cmd_type))
@@ -565,6 +575,97 @@ int doCmdPiVDU(const char *params) {
    return 0;
 }
 
+int doCmdPiVDUQ(const char *params) {
+   vdu_queue_stats_t stats;
+   // *PIVDUQ R resets the statistics after reporting them
+   int reset = (*params == 'R' || *params == 'r');
+   fb_get_vdu_queue_stats(&stats, reset);
+   sprintf(line, "VDU queue size: %u\r\n", stats.size);
+   OS_Write0(line);
+   sprintf(line, "   Queue depth: %u\r\n", stats.depth);
+   OS_Write0(line);
+   sprintf(line, "    Peak depth: %u\r\n", stats.peak_depth);
+   OS_Write0(line);
+   sprintf(line, "        Stalls: %u (%u us)\r\n", stats.stalls, stats.stall_time);
+   OS_Write0(line);
+   sprintf(line, "     Overflows: %u\r\n", stats.overflows);
+   OS_Write0(line);
+   return 0;
+}
+
+int doCmdXfers(const char *params) {
+   tube_transfer_stats_t stats;
+   // *XFERS R resets the statistics after reporting them
+   int reset = (*params == 'R' || *params == 'r');
+   tube_get_transfer_stats(&stats, reset);
+   sprintf(line, "Transfers: %u\r\n", stats.transfers);
+   OS_Write0(line);
+   sprintf(line, "    Total: %u bytes in %u us (%u bytes/s)\r\n", stats.bytes, stats.time,
+           stats.time ? (unsigned int)((unsigned long long)stats.bytes * 1000000 / stats.time) : 0);
+   OS_Write0(line);
+   sprintf(line, "     Last: %u bytes in %u us (%u bytes/s)\r\n", stats.last_bytes, stats.last_time,
+           stats.last_time ? (unsigned int)((unsigned long long)stats.last_bytes * 1000000 / stats.last_time) : 0);
+   OS_Write0(line);
+   return 0;
+}
+
+// Converts a time in processor cycles to ns
+static unsigned int fiq_latency_ns(unsigned int cycles) {
+   return (unsigned int)((unsigned long long)cycles * 1000000000 / arm_speed);
+}
+
+// Returns the upper bound (in ns) of the bucket holding the given fraction
+// (in tenths of a percent) of the times, or 0 if that is the overflow bucket
+static unsigned int fiq_latency_percentile(const tube_fiq_latency_t *latency, unsigned int total, unsigned int per_mille) {
+   unsigned long long target = ((unsigned long long)total * per_mille + 999) / 1000;
+   unsigned int sum = 0;
+   for (unsigned int i = 0; i < FIQ_LATENCY_BUCKETS - 1; i++) {
+      sum += latency->count[i];
+      if (sum >= target) {
+         return fiq_latency_ns((i + 1) * FIQ_LATENCY_BUCKET_CYCLES);
+      }
+   }
+   return 0;
+}
+
+int doCmdFiqLat(const char *params) {
+   static tube_fiq_latency_t latency[FIQ_LATENCY_TYPES];
+   static const unsigned int per_mille[] = { 500, 900, 990, 999 };
+   // *FIQLAT R resets the histograms after reporting them
+   int reset = (*params == 'R' || *params == 'r');
+   if (!tube_get_fiq_latency(latency, reset)) {
+      OS_Write0("FIQ latency instrumentation not enabled (see DEBUG_FIQ_LATENCY)\r\n");
+      return 0;
+   }
+   OS_Write0("Access          Count    50%    90%    99%  99.9%    Max (ns)\r\n");
+   for (unsigned int type = 0; type < FIQ_LATENCY_TYPES; type++) {
+      unsigned int total = 0;
+      for (unsigned int i = 0; i < FIQ_LATENCY_BUCKETS; i++) {
+         total += latency[type].count[i];
+      }
+      if (total == 0) {
+         continue;
+      }
+      // Type is RnW and A2..A0
+      sprintf(line, "&FEE%u %-5s %10u", type & 7, (type & 8) ? "read" : "write", total);
+      OS_Write0(line);
+      for (unsigned int p = 0; p < sizeof(per_mille) / sizeof(per_mille[0]); p++) {
+         unsigned int ns = fiq_latency_percentile(latency + type, total, per_mille[p]);
+         if (ns) {
+            sprintf(line, " %6u", ns);
+         } else {
+            sprintf(line, " %6s", "long");
+         }
+         OS_Write0(line);
+      }
+      sprintf(line, " %6u\r\n", fiq_latency_ns(latency[type].max));
+      OS_Write0(line);
+   }
+   sprintf(line, "Resolution is %u cycles (%u ns)\r\n", FIQ_LATENCY_BUCKET_CYCLES, fiq_latency_ns(FIQ_LATENCY_BUCKET_CYCLES));
+   OS_Write0(line);
+   return 0;
+}
+
 int doCmdPiLIFE(const char *params) {
    unsigned int mode = 1;
 
@@ -684,3 +785,47 @@ int doCmdPiLIFE(const char *params) {
 
    return 0;
 }
+
+static void vdu_coord(int c) {
+   OS_WriteC((unsigned char)(c & 255));
+   OS_WriteC((unsigned char)((c >> 8) & 255));
+}
+
+int doCmdPiTRI(const char *params) {
+   int triangles = 0;
+
+   params = copy_string(params);
+   if (sscanf(params, "%d", &triangles) < 1) {
+      triangles = 10000;
+   }
+
+   // Use a fixed seed so successive runs plot the same triangles
+   srandom(1);
+
+   unsigned int start = RPI_GetSystemTimer()->counter_lo;
+
+   // Same workload as the triangles demo: random GCOL, MOVE, MOVE, PLOT 85
+   for (int i = 0; i < triangles; i++) {
+      OS_WriteC(18);
+      OS_WriteC(0);
+      OS_WriteC((unsigned char)(random() & 63));
+      for (int v = 0; v < 3; v++) {
+         OS_WriteC(25);
+         OS_WriteC(v < 2 ? 4 : 85);
+         vdu_coord((int)(random() % 1280));
+         vdu_coord((int)(random() % 1024));
+      }
+   }
+
+   unsigned int elapsed = RPI_GetSystemTimer()->counter_lo - start;
+
+   sprintf(line, "%d triangles in %u us", triangles, elapsed);
+   OS_Write0(line);
+   if (elapsed) {
+      sprintf(line, " (%u per second)", (unsigned int)(((uint64_t) triangles * 1000000) / elapsed));
+      OS_Write0(line);
+   }
+   OS_Write0("\r\n");
+
+   return 0;
+}
@@ -1,8 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "copro-armnative.h"
 
+#include "rpi-systimer.h"
 #include "startup.h"
 #include "swi.h"
 #include "tube-lib.h"
@@ -17,6 +19,35 @@ static volatile unsigned int signature;
 
 static ErrorBlock_type isrErrorBlock;
 
+// Throughput of the R3 data transfers, from the sync byte to the last data byte
+static tube_transfer_stats_t transfer_stats;
+static unsigned int transfer_start;
+
+static void start_transfer() {
+  count = 0;
+  signature = 0;
+  transfer_start = RPI_GetSystemTimer()->counter_lo;
+}
+
+static void end_transfer() {
+  unsigned int time = RPI_GetSystemTimer()->counter_lo - transfer_start;
+  transfer_stats.transfers++;
+  transfer_stats.bytes += count;
+  transfer_stats.time += time;
+  transfer_stats.last_bytes = count;
+  transfer_stats.last_time = time;
+  if (DEBUG_TRANSFER_CRC) {
+    printf("count = %0x signature = %0x\r\n", count, signature);
+  }
+}
+
+void tube_get_transfer_stats(tube_transfer_stats_t *stats, int reset) {
+  *stats = transfer_stats;
+  if (reset) {
+    memset(&transfer_stats, 0, sizeof(transfer_stats));
+  }
+}
+
 #ifdef TUBE_ISR_STATE_MACHINE
 
 static int ignore_transfer = 0;
@@ -56,15 +87,18 @@ typedef enum {
 } r4_state_type;
 
 
-void copro_armnative_tube_interrupt_handler(uint32_t mail) {
-  static r1_state_type r1_state = IDLE_R1;
-  static r4_state_type r4_state = IDLE_R4;
+static r1_state_type r1_state = IDLE_R1;
+static r4_state_type r4_state = IDLE_R4;
 
+// Bytes left in a type 6/7 burst, and the direction of the host's R3 accesses
+// (1 = reads for type 6, 0 = writes for type 7) that move them
+static int remaining;
+static int burst_rnw;
+
+void copro_armnative_tube_interrupt_handler(uint32_t mail) {
   static unsigned char type;
   static ErrorBlock_type *eblk;
 
-  static int remaining;
-
   int addr;
   int rnw;
   int ntube;
@@ -79,10 +113,36 @@ void copro_armnative_tube_interrupt_handler(uint32_t mail) {
   if (nrst == 0) {
     r1_state = IDLE_R1;
     r4_state = IDLE_R4;
+    remaining = 0;
     copro_armnative_reset();
     // This never returns as it uses longjmp
   }
 
+  // Type 6/7 bursts move a byte on every host access to R3, so these
+  // are handled first with the minimum of work
+  if (remaining > 0 && addr == 5 && rnw == burst_rnw) {
+    if (rnw) {
+      // Write the R3 data register, which should also clear the NMI
+      tubeWrite(R3_DATA, *tube_address);
+    } else if (ignore_transfer) {
+      tubeRead(R3_DATA);
+    } else {
+      // Read the R3 data register, which should also clear the NMI
+      *tube_address = tubeRead(R3_DATA);
+    }
+    if (DEBUG_TRANSFER_CRC) {
+      signature += *tube_address;
+      signature *= 13;
+    }
+    tube_address++;
+    count++;
+    if (--remaining == 0) {
+      r4_state = IDLE_R4;
+      end_transfer();
+    }
+    return;
+  }
+
   // State machine updates on tube write cycles
 
   if (nrst == 1 && ntube == 0 && rnw == 0 && addr == 1) {
@@ -223,11 +283,11 @@ void copro_armnative_tube_interrupt_handler(uint32_t mail) {
     case TRANSFER_R4_SYNC:
       if (addr == 7) {
         tubeRead(R4_DATA);
-        count = 0;
-        signature = 0;
+        start_transfer();
         switch (type) {
         case 6:
           remaining = 256;
+          burst_rnw = 1;
           // fall through
         case 0:
         case 2:
@@ -235,11 +295,15 @@ void copro_armnative_tube_interrupt_handler(uint32_t mail) {
           // For a copro->host transfer, send the first byte in response to the sync byte
           tubeWrite(R3_DATA, *tube_address);
           count++;
-          signature += *tube_address++;
-          signature *= 13;
+          if (DEBUG_TRANSFER_CRC) {
+            signature += *tube_address;
+            signature *= 13;
+          }
+          tube_address++;
           break;
         case 7:
           remaining = 256;
+          burst_rnw = 0;
           // fall through
         case 1:
         case 3:
@@ -257,30 +321,26 @@ void copro_armnative_tube_interrupt_handler(uint32_t mail) {
       break;
 
     case TRANSFER_R3:
+      // Bursts (type 6/7) are handled before the state machine
       if (addr == 5) {
-        if (type == 1 || type == 3 || (type == 7 && remaining > 0)) {
+        if (type == 1 || type == 3) {
           // Read the R3 data register, which should also clear the NMI
           if (ignore_transfer) {
-            signature += tubeRead(R3_DATA);
+            tubeRead(R3_DATA);
           } else {
             *tube_address = tubeRead(R3_DATA);
+          }
+          if (DEBUG_TRANSFER_CRC) {
             signature += *tube_address;
+            signature *= 13;
           }
           tube_address++;
           count++;
-          signature *= 13;
-        }
-        if (type == 7 && remaining > 0) {
-          remaining--;
-          if (remaining == 0) {
-            r4_state = IDLE_R4;
-          }
         }
       } else if (addr == 7) {
-        // R4 interrupt
-        if (DEBUG_TRANSFER_CRC) {
-          printf("count = %0x signature = %0x\r\n", count, signature);
-        }
+        // R4 interrupt, which ends a type 0-3 transfer
+        remaining = 0;
+        end_transfer();
         type = tubeRead(R4_DATA);
         if (type == 0xff) {
           r4_state = ERROR_R2_00;
@@ -297,18 +357,15 @@ void copro_armnative_tube_interrupt_handler(uint32_t mail) {
   if (nrst == 1 && ntube == 0 && rnw == 1) {
     if (r4_state == TRANSFER_R3) {
       if (addr == 5) {
-        if (type == 0 || type == 2 || (type == 6 && remaining > 0)) {
+        if (type == 0 || type == 2) {
           // Write the R3 data register, which should also clear the NMI
           tubeWrite(R3_DATA, *tube_address);
-          count++;
-          signature += *tube_address++;
-          signature *= 13;
-        }
-        if (type == 6 && remaining > 0) {
-          remaining--;
-          if (remaining == 0) {
-            r4_state = IDLE_R4;
+          if (DEBUG_TRANSFER_CRC) {
+            signature += *tube_address;
+            signature *= 13;
           }
+          tube_address++;
+          count++;
         }
       }
     }
@@ -538,8 +595,7 @@ void copro_armnative_tube_interrupt_handler(void) {
       }
       // The data transfers are done by polling the mailbox directly
       // so disable interrupts to prevent the FIQ handler reading the mailbox
-      count = 0;
-      signature = 0;
+      start_transfer();
       switch (type) {
       case 0:
         _disable_interrupts();
@@ -568,8 +624,8 @@ void copro_armnative_tube_interrupt_handler(void) {
         type_7_data_transfer();
         break;
       }
-      if (DEBUG_TRANSFER_CRC) {
-        printf("count = %0x signature = %0x\r\n", count, signature);
+      if (type != 4 && type != 5) {
+        end_transfer();
       }
       // type 0..3 data transfers will be terminated by an interrupt, so call
       // ourselves recursively or this will be not be processed
@@ -5,6 +5,14 @@
 
 extern volatile unsigned char *tube_address;
 
+typedef struct {
+   unsigned int transfers;  // number of R3 data transfers
+   unsigned int bytes;      // total bytes moved
+   unsigned int time;       // total time taken (us)
+   unsigned int last_bytes; // bytes moved by the most recent transfer
+   unsigned int last_time;  // time taken by the most recent transfer (us)
+} tube_transfer_stats_t;
+
 #ifdef TUBE_ISR_STATE_MACHINE
 extern void copro_armnative_tube_interrupt_handler(uint32_t mail);
 #else
@@ -13,4 +21,6 @@ extern void copro_armnative_tube_interrupt_handler();
 
 void set_ignore_transfer(int on);
 
+void tube_get_transfer_stats(tube_transfer_stats_t *stats, int reset);
+
 #endif
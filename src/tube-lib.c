@@ -10,24 +10,15 @@
 
 static int debug = 0;
 
+// tube_parasite_read/write are already atomic with respect to the host side
 unsigned char tubeRead(unsigned char addr)
 {
-  unsigned char ret;
-  int cpsr = _disable_interrupts();
-  ret = tube_parasite_read(addr);
-  if ((cpsr & 0xc0) != 0xc0) {
-    _enable_interrupts();
-  }
-  return ret;
+  return tube_parasite_read(addr);
 }
 
 void tubeWrite(unsigned char addr, unsigned char byte)
 {
-  int cpsr = _disable_interrupts();
   tube_parasite_write(addr, byte);
-  if ((cpsr & 0xc0) != 0xc0) {
-    _enable_interrupts();
-  }
 }
 
 void setTubeLibDebug(int d)
@@ -38,40 +29,59 @@ void setTubeLibDebug(int d)
 // Reg is 1..4
 void sendByte(unsigned char reg, unsigned char byte)
 {
-  unsigned char addr = (unsigned char) ((reg - 1) *2);
   if (debug >= 2)
   {
     printf("waiting for space in R%d\r\n", reg);
   }
-  while ((tubeRead(addr) & F_BIT) == 0x00)
+  // The status check and the write are a single critical section
+  while (!tube_parasite_send((unsigned int) (reg - 1), byte))
     ;
   if (debug >= 2)
   {
     printf("done waiting for space in R%d\r\n", reg);
   }
-  tubeWrite(addr + 1, byte);
   if (debug >= 1)
   {
     printf("Tx: R%d = %02x\r\n", reg, byte);
   }
 }
 
+// Reg is 1..4
+void sendBytes(unsigned char reg, unsigned int len, const unsigned char *buf)
+{
+  // bytes are transferred in order, and R1 (a FIFO) is filled a slot at a time
+  // only when debugging, otherwise with as many bytes as there is space for
+  if (reg == R1_ID && debug == 0)
+  {
+    while (len > 0)
+    {
+      unsigned int sent = tube_parasite_send_r1(buf, len);
+      buf += sent;
+      len -= sent;
+    }
+    return;
+  }
+  while (len-- > 0)
+  {
+    sendByte(reg, *buf++);
+  }
+}
+
 // Reg is 1..4
 unsigned char receiveByte(unsigned char reg)
 {
   unsigned char byte;
-  unsigned char addr = (unsigned char) ((reg - 1) * 2);
   if (debug >= 2)
   {
     printf("waiting for data in R%d\r\n", reg);
   }
-  while ((tubeRead(addr) & A_BIT) == 0x00)
+  // The status check and the read are a single critical section
+  while (!tube_parasite_receive((unsigned int) (reg - 1), &byte))
     ;
   if (debug >= 2)
   {
     printf("done waiting for data in R%d\r\n", reg);
   }
-  byte = tubeRead(addr + 1);
   if (debug >= 1)
   {
     printf("Rx: R%d = %02x\r\n", reg, byte);
@@ -130,7 +140,6 @@ void sendBlock(unsigned char reg, unsigned int len, const unsigned char *buf)
 // Reg is 1..4
 void receiveBlock(unsigned char reg, unsigned int len, unsigned char *buf)
 {
-  // bytes in a block are transferred high downto low
   // bytes in a block are transferred high downto low
   buf += len;
   while (len-- > 0)
@@ -160,3 +169,25 @@ unsigned int receiveWord(unsigned char reg)
   word |= receiveByte(reg);
   return word;
 }
+
+// Reg is 1..4
+void sendWordBlock(unsigned char reg, unsigned int len, const unsigned int *words)
+{
+  // words are transferred high downto low, as in the OSFILE and OSGBPB parameter blocks
+  words += len;
+  while (len-- > 0)
+  {
+    sendWord(reg, *--words);
+  }
+}
+
+// Reg is 1..4
+void receiveWordBlock(unsigned char reg, unsigned int len, unsigned int *words)
+{
+  // words are transferred high downto low, as in the OSFILE and OSGBPB parameter blocks
+  words += len;
+  while (len-- > 0)
+  {
+    *--words = receiveWord(reg);
+  }
+}
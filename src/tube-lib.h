@@ -33,6 +33,8 @@ void setTubeLibDebug(int d);
 
 void sendByte(unsigned char reg, unsigned char byte);
 
+void sendBytes(unsigned char reg, unsigned int len, const unsigned char *buf);
+
 unsigned char receiveByte(unsigned char reg);
 
 void sendStringWithoutTerminator(unsigned char reg, const volatile char *buf);
@@ -49,4 +51,8 @@ void sendWord(unsigned char reg, unsigned int word);
 
 unsigned int receiveWord(unsigned char reg);
 
+void sendWordBlock(unsigned char reg, unsigned int len, const unsigned int *words);
+
+void receiveWordBlock(unsigned char reg, unsigned int len, unsigned int *words);
+
 #endif
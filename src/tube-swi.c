@@ -438,6 +438,55 @@ static module_t *module_list[] = {
 
 #define NUM_MODULES (sizeof(module_list) / sizeof(module_t *))
 
+// SWIs are allocated to modules in chunks of 64, so dispatch uses a two level
+// table built from module_list: the top level is indexed by bits 12-23 of the
+// SWI number and selects a page, which is indexed by bits 6-11 (the chunk within
+// the page) and gives the owning module. Page 0 is always empty, so unused parts
+// of the SWI space need no special casing.
+
+#define SWI_CHUNK_SHIFT  6
+#define SWI_PAGE_SHIFT  12
+#define SWI_PAGE_CHUNKS (1 << (SWI_PAGE_SHIFT - SWI_CHUNK_SHIFT))
+#define SWI_NUM_PAGES   (1 << (24 - SWI_PAGE_SHIFT))
+#define SWI_MAX_PAGES    8
+
+static uint8_t   swi_page_index[SWI_NUM_PAGES];
+static module_t *swi_pages[SWI_MAX_PAGES][SWI_PAGE_CHUNKS];
+
+static void swi_dispatch_init() {
+   unsigned int num_pages = 1;
+   memset(swi_page_index, 0, sizeof(swi_page_index));
+   memset(swi_pages, 0, sizeof(swi_pages));
+   for (unsigned int m = 0; m < NUM_MODULES; m++) {
+      module_t *module = module_list[m];
+      for (unsigned int chunk = module->swi_num_min >> SWI_CHUNK_SHIFT; chunk <= module->swi_num_max >> SWI_CHUNK_SHIFT; chunk++) {
+         unsigned int page = chunk >> (SWI_PAGE_SHIFT - SWI_CHUNK_SHIFT);
+         if (!swi_page_index[page]) {
+            if (num_pages == SWI_MAX_PAGES) {
+               printf("Out of SWI dispatch pages for module %s\r\n", module->name);
+               break;
+            }
+            swi_page_index[page] = (uint8_t) num_pages++;
+         }
+         // As with a linear search of module_list, the first module wins
+         module_t **entry = &swi_pages[swi_page_index[page]][chunk & (SWI_PAGE_CHUNKS - 1)];
+         if (*entry == NULL) {
+            *entry = module;
+         }
+      }
+   }
+}
+
+// Returns the module implementing num (which must have the X bit cleared), or NULL
+static inline module_t *lookup_swi_module(unsigned int num) {
+   num &= 0xFFFFFF;
+   module_t *module = swi_pages[swi_page_index[num >> SWI_PAGE_SHIFT]][(num >> SWI_CHUNK_SHIFT) & (SWI_PAGE_CHUNKS - 1)];
+   if (module && num >= module->swi_num_min && num <= module->swi_num_max) {
+      return module;
+   }
+   return NULL;
+}
+
 void swi_modules_init(int vdu) {
    for (unsigned int m = 0; m < NUM_MODULES; m++) {
       module_t *module = module_list[m];
@@ -445,6 +494,7 @@ void swi_modules_init(int vdu) {
          module->init(vdu);
       }
    }
+   swi_dispatch_init();
 }
 
 static char *lookup_swi_name(unsigned int num) {
@@ -469,16 +519,13 @@ static char *lookup_swi_name(unsigned int num) {
       // Default to user
       strcpy(ptr, "User");
       // Consult modules, the first one being the OS
-      for (unsigned int m = 0; m < NUM_MODULES; m++) {
-         module_t *module = module_list[m];
-         if (num >= module->swi_num_min && num <= module->swi_num_max) {
-            const char *swi_name = module->swi_table[num - module->swi_num_min].name;
-            if (swi_name != NULL) {
-               sprintf(ptr, "%s_%s", module->name, swi_name);
-            } else {
-               sprintf(ptr, "%s_%s", module->name, "Undefined");
-            }
-            break;
+      module_t *module = lookup_swi_module(num);
+      if (module) {
+         const char *swi_name = module->swi_table[num - module->swi_num_min].name;
+         if (swi_name != NULL) {
+            sprintf(ptr, "%s_%s", module->name, swi_name);
+         } else {
+            sprintf(ptr, "%s_%s", module->name, "Undefined");
          }
       }
    }
@@ -569,12 +616,9 @@ void C_SWI_Handler(unsigned int number, unsigned int *reg) {
      os_table[SWI_OS_WriteC].handler(&num);
   } else {
      SWIHandler_Type handler = NULL;
-     for (unsigned int m = 0; m < NUM_MODULES; m++) {
-        module_t *module = module_list[m];
-        if (num >= module->swi_num_min && num <= module->swi_num_max) {
-           handler = module->swi_table[num - module->swi_num_min].handler;
-           break;
-        }
+     module_t *module = lookup_swi_module(num);
+     if (module) {
+        handler = module->swi_table[num - module->swi_num_min].handler;
      }
      if (handler != NULL) {
         handler(reg);
@@ -692,12 +736,10 @@ void user_exec_raw(volatile unsigned char *address) {
 }
 
 static char *write_string(char *ptr) {
-  unsigned char c;
   // Output characters pointed to by R0, until a terminating zero
-  while ((c = *ptr++) != 0) {
-    sendByte(R1_ID, c);
-  }
-  return ptr;
+  size_t len = strlen(ptr);
+  sendBytes(R1_ID, (unsigned int) len, (unsigned char *) ptr);
+  return ptr + len + 1;
 }
 // Client to Host transfers
 // Reference: http://mdfs.net/Software/Tube/Protocol
@@ -716,6 +758,211 @@ static char *write_string(char *ptr) {
 // OSFILE   R2: &14 block string &0D A            A block
 // OSGBPB   R2: &16 block A                       block Cy A
 
+// File buffering
+//
+// OS_BGet and OS_BPut would otherwise need a host round trip per byte, so a
+// few handles at a time get a read-ahead or write-behind buffer, which is
+// moved to or from the host in bulk with OSGBPB (the data itself travelling
+// over the R3 transfer protocol).
+//
+// Read-ahead never goes beyond EXT, so the host's own OSBGET still handles
+// end of file, including the EOF error on reading past it. Reading PTR, EXT
+// or EOF is answered from the buffer. Any other call that could observe or
+// change the file (OSARGS, OSGBPB, OSFIND, OSFILE and OSCLI) first writes
+// back pending bytes, or winds PTR back over bytes read ahead but not
+// consumed, and releases the buffer.
+//
+// Writes are only buffered for handles opened by OSFIND for output or update,
+// so BPUT# to a handle opened for input still fails straight away. A host
+// error while writing back (e.g. the disc being full) is reported by the call
+// that caused the write back rather than by the BPUT# that wrote the byte.
+
+#define NUM_FILE_BUFFERS 4
+#define FILE_BUFFER_SIZE 256
+
+typedef struct {
+  unsigned char handle;   // 0 if the buffer is free
+  unsigned char writing;  // 1 if holding bytes to write, 0 if holding bytes read ahead
+  unsigned int len;       // number of bytes in the buffer
+  unsigned int index;     // next byte to be read
+  unsigned int ptr;       // host PTR, i.e. the file offset just after the buffer when reading, or at its start when writing
+  unsigned int ext;       // host EXT
+  unsigned char data[FILE_BUFFER_SIZE];
+} file_buffer_t;
+
+static file_buffer_t file_buffers[NUM_FILE_BUFFERS];
+
+static unsigned int file_buffer_victim;
+
+// Handles whose filing system doesn't support OSGBPB
+static unsigned int file_unbuffered[256 / 32];
+
+// Handles opened by OSFIND for output or update
+static unsigned int file_output[256 / 32];
+
+static unsigned char host_GBPB(unsigned char a, unsigned char handle, unsigned char *data, unsigned int *count, unsigned int *ptr) {
+  // OSGBPB   R2: &16 block A                       block Cy A
+  sendByte(R2_ID, 0x16);
+  sendWord(R2_ID, *ptr);
+  sendWord(R2_ID, *count);
+  sendWord(R2_ID, (unsigned int) data);
+  sendByte(R2_ID, handle);
+  sendByte(R2_ID, a);
+  *ptr = receiveWord(R2_ID);
+  *count = receiveWord(R2_ID);
+  receiveWord(R2_ID);
+  receiveByte(R2_ID);
+  receiveByte(R2_ID);
+  return receiveByte(R2_ID);
+}
+
+static unsigned int host_Args(unsigned char a, unsigned char handle, unsigned int value) {
+  // OSARGS   R2: &0C Y block A                     A block
+  sendByte(R2_ID, 0x0C);
+  sendByte(R2_ID, handle);
+  sendWord(R2_ID, value);
+  sendByte(R2_ID, a);
+  receiveByte(R2_ID);
+  return receiveWord(R2_ID);
+}
+
+static void host_BPut(unsigned char handle, unsigned char c) {
+  // OSBPUT   R2: &10 Y A                           &7F
+  sendByte(R2_ID, 0x10);
+  sendByte(R2_ID, handle);
+  sendByte(R2_ID, c);
+  // Response is always 7F so ignored
+  receiveByte(R2_ID);
+}
+
+// Bring the host file up to date with the buffer, and release it
+static void sync_file_buffer(file_buffer_t *b) {
+  unsigned char handle = b->handle;
+  unsigned int len = b->len;
+  unsigned int index = b->index;
+  // Release the buffer first, in case the host reports an error
+  b->handle = 0;
+  b->len = 0;
+  b->index = 0;
+  if (b->writing) {
+    if (len) {
+      unsigned int count = len;
+      unsigned int ptr = 0;
+      if (host_GBPB(2, handle, b->data, &count, &ptr)) {
+        // Not supported, so write the bytes individually from now on
+        file_unbuffered[handle >> 5] |= 1u << (handle & 31);
+        for (unsigned int i = 0; i < len; i++) {
+          host_BPut(handle, b->data[i]);
+        }
+      }
+    }
+  } else if (index < len) {
+    // Wind PTR back over the bytes read ahead but not consumed
+    host_Args(1, handle, b->ptr - (len - index));
+  }
+}
+
+// Sync the buffer for one handle, or for all handles if handle is 0
+static void sync_file_buffers(unsigned char handle) {
+  for (int i = 0; i < NUM_FILE_BUFFERS; i++) {
+    file_buffer_t *b = &file_buffers[i];
+    if (b->handle && (handle == 0 || b->handle == handle)) {
+      sync_file_buffer(b);
+    }
+  }
+}
+
+// Return the buffer currently held for a handle, or NULL if there isn't one
+static file_buffer_t *find_file_buffer(unsigned char handle) {
+  for (int i = 0; i < NUM_FILE_BUFFERS; i++) {
+    if (handle && file_buffers[i].handle == handle) {
+      return &file_buffers[i];
+    }
+  }
+  return NULL;
+}
+
+// PTR as the program sees it
+static unsigned int file_buffer_ptr(const file_buffer_t *b) {
+  if (b->writing) {
+    return b->ptr + b->len;
+  } else {
+    return b->ptr - (b->len - b->index);
+  }
+}
+
+// EXT as the program sees it
+static unsigned int file_buffer_ext(const file_buffer_t *b) {
+  if (b->writing && b->ptr + b->len > b->ext) {
+    return b->ptr + b->len;
+  } else {
+    return b->ext;
+  }
+}
+
+// Find (or allocate) the buffer for a handle, or return NULL if it can't be buffered
+static file_buffer_t *get_file_buffer(unsigned char handle, unsigned char writing) {
+  if (handle == 0 || (file_unbuffered[handle >> 5] & (1u << (handle & 31)))) {
+    return NULL;
+  }
+  if (writing && !(file_output[handle >> 5] & (1u << (handle & 31)))) {
+    return NULL;
+  }
+  file_buffer_t *b = find_file_buffer(handle);
+  if (b) {
+    if (b->writing == writing) {
+      return b;
+    }
+    // Switching between reading and writing
+    sync_file_buffer(b);
+  }
+  if (!b) {
+    for (int i = 0; i < NUM_FILE_BUFFERS; i++) {
+      if (!file_buffers[i].handle) {
+        b = &file_buffers[i];
+        break;
+      }
+    }
+  }
+  if (!b) {
+    b = &file_buffers[file_buffer_victim];
+    file_buffer_victim = (file_buffer_victim + 1) % NUM_FILE_BUFFERS;
+    sync_file_buffer(b);
+  }
+  b->writing = writing;
+  b->len = 0;
+  b->index = 0;
+  // Note where the file ends, so the read-ahead can stop short of it, and so
+  // PTR, EXT and EOF can be answered without a host round trip
+  b->ptr = host_Args(0, handle, 0);
+  b->ext = host_Args(2, handle, 0);
+  b->handle = handle;
+  return b;
+}
+
+// Read ahead up to FILE_BUFFER_SIZE bytes, stopping at EXT
+static void fill_file_buffer(file_buffer_t *b) {
+  unsigned int count = b->ext > b->ptr ? b->ext - b->ptr : 0;
+  b->len = 0;
+  b->index = 0;
+  if (count == 0) {
+    return;
+  }
+  if (count > FILE_BUFFER_SIZE) {
+    count = FILE_BUFFER_SIZE;
+  }
+  unsigned int requested = count;
+  unsigned int ptr = 0;
+  if (host_GBPB(4, b->handle, b->data, &count, &ptr)) {
+    // Not supported, so read the bytes individually from now on
+    file_unbuffered[b->handle >> 5] |= 1u << (b->handle & 31);
+    b->handle = 0;
+    return;
+  }
+  b->len = requested - count;
+  b->ptr = ptr;
+}
+
 static void tube_WriteC(unsigned int *reg) {
   sendByte(R1_ID, (unsigned char)((reg[0]) & 0xff));
 }
@@ -734,8 +981,8 @@ static void tube_Write0(unsigned int *reg) {
 }
 
 static void tube_NewLine(unsigned int *reg) {
-  sendByte(R1_ID, 0x0A);
-  sendByte(R1_ID, 0x0D);
+  static const unsigned char newline[] = { 0x0A, 0x0D };
+  sendBytes(R1_ID, sizeof(newline), newline);
 }
 
 static void tube_ReadC(unsigned int *reg) {
@@ -752,6 +999,9 @@ static void tube_ReadC(unsigned int *reg) {
 
 static void tube_CLI(unsigned int *reg) {
 
+  // Commands such as *CLOSE can act on open files
+  sync_file_buffers(0);
+
   // Keep a copy of the original command, so it's not perturbed when we fake the environmeny
   char command[256];
   char *ptr = (char *)(*reg);
@@ -859,6 +1109,14 @@ static void tube_Byte(unsigned int *reg) {
   unsigned char a = reg[0] & 0xff;
   unsigned char x = reg[1] & 0xff;
   unsigned char y = reg[2] & 0xff;
+  if (a == 0x7F) {
+    // EOF# can be answered from the buffer, if there is one
+    file_buffer_t *b = find_file_buffer(x);
+    if (b) {
+      reg[1] = file_buffer_ptr(b) >= file_buffer_ext(b) ? 0xFF : 0x00;
+      return;
+    }
+  }
   if (a < 128) {
      // OSBYTELO R2: &04 X A                           X
      sendByte(R2_ID, 0x04);
@@ -1018,31 +1276,47 @@ static void tube_File(unsigned int *reg) {
     printf("%08x %08x %08x %08x %08x %08x\r\n", reg[0], reg[1], reg[2], reg[3], reg[4], reg[5]);
     print_debug_string((char *)reg[1]);
   }
-  // start at the last param (r5)
-  unsigned int *ptr = reg + 5;
+  // Catalogue information for an open file should reflect what's been written
+  sync_file_buffers(0);
   // OSFILE   R2: &14 block string &0D A            A block
   sendByte(R2_ID, 0x14);
-  sendWord(R2_ID, *ptr--);            // r5 = attr
-  sendWord(R2_ID, *ptr--);            // r4 = leng
-  sendWord(R2_ID, *ptr--);            // r3 = exec
-  sendWord(R2_ID, *ptr--);            // r2 = load
+  sendWordBlock(R2_ID, 4, reg + 2);   // r5..r2 = attr, leng, exec, load
   // Send the filename, excluding terminating control character (anything < 0x20)
-  sendStringWithoutTerminator(R2_ID, (char *)*ptr--);  // r1 = filename ptr
+  sendStringWithoutTerminator(R2_ID, (char *)reg[1]);  // r1 = filename ptr
   // Send the 0x0D terminator
   sendByte(R2_ID, 0x0D);
-  sendByte(R2_ID, (unsigned char )*ptr);              // r0 = action
-  *ptr = receiveByte(R2_ID);          // r0 = action
-  ptr = reg + 5;                   // ptr = r5
-  *ptr-- = receiveWord(R2_ID);        // r5 = attr
-  *ptr-- = receiveWord(R2_ID);        // r4 = lang
-  *ptr-- = receiveWord(R2_ID);        // r3 = exec
-  *ptr-- = receiveWord(R2_ID);        // r2 = load
+  sendByte(R2_ID, (unsigned char )reg[0]);            // r0 = action
+  reg[0] = receiveByte(R2_ID);                        // r0 = action
+  receiveWordBlock(R2_ID, 4, reg + 2);                // r5..r2 = attr, leng, exec, load
   if (DEBUG_ARM) {
     printf("%08x %08x %08x %08x %08x %08x\r\n", reg[0], reg[1], reg[2], reg[3], reg[4], reg[5]);
   }
 }
 
 static void tube_Args(unsigned int *reg) {
+  unsigned char a = (unsigned char)reg[0];
+  unsigned char handle = (unsigned char)reg[1];
+  if (handle) {
+    // Reading PTR, EXT or EOF can be answered from the buffer, if there is one
+    file_buffer_t *b = find_file_buffer(handle);
+    if (b && (a == 0 || a == 2 || a == 5)) {
+      unsigned int ptr = file_buffer_ptr(b);
+      unsigned int ext = file_buffer_ext(b);
+      if (a == 0) {
+        reg[2] = ptr;
+      } else if (a == 2) {
+        reg[2] = ext;
+      } else {
+        reg[2] = ptr >= ext ? 1 : 0;
+      }
+      return;
+    }
+    sync_file_buffers(handle);
+  } else if (a >= 2) {
+    // Handle 0 covers all files (e.g. ensure all buffers are written), except
+    // for reading the filing system number or command line address
+    sync_file_buffers(0);
+  }
   // OSARGS   R2: &0C Y block A                     A block
   sendByte(R2_ID, 0x0C);
   // Y = R1 is the file namdle
@@ -1058,6 +1332,18 @@ static void tube_Args(unsigned int *reg) {
 }
 
 static void tube_BGet(unsigned int *reg) {
+  file_buffer_t *b = get_file_buffer((unsigned char)reg[1], 0);
+  if (b) {
+    if (b->index == b->len) {
+      fill_file_buffer(b);
+    }
+    if (b->index < b->len) {
+      updateCarry(0, reg);
+      reg[0] = b->data[b->index++];
+      return;
+    }
+    // At EXT, so let the host handle end of file
+  }
   // OSBGET   R2: &0E Y                             Cy A
   sendByte(R2_ID, 0x0E);
   // Y = R1 is the file namdle
@@ -1069,36 +1355,46 @@ static void tube_BGet(unsigned int *reg) {
 }
 
 static void tube_BPut(unsigned int *reg) {
-  // OSBPUT   R2: &10 Y A                           &7F
-  sendByte(R2_ID, 0x10);
-  // Y = R1 is the file namdle
-  sendByte(R2_ID, (unsigned char )reg[1]);
-  // A = R0 is the character
-  sendByte(R2_ID, (unsigned char )reg[0]);
-  // Response is always 7F so ignored
-  receiveByte(R2_ID);
+  file_buffer_t *b = get_file_buffer((unsigned char)reg[1], 1);
+  if (b) {
+    b->data[b->len++] = (unsigned char)reg[0];
+    if (b->len == FILE_BUFFER_SIZE) {
+      sync_file_buffer(b);
+    }
+    return;
+  }
+  host_BPut((unsigned char)reg[1], (unsigned char)reg[0]);
 }
 
 static void tube_GBPB(unsigned int *reg) {
-  // start at the last param (r4)
-  unsigned int *ptr = reg + 4;
+  // Reasons 1-4 access an open file
+  if (reg[0] >= 1 && reg[0] <= 4) {
+    sync_file_buffers((unsigned char)reg[1]);
+  }
   // OSGBPB   R2: &16 block A                       block Cy A
   sendByte(R2_ID, 0x16);
-  sendWord(R2_ID, *ptr--);              // r4
-  sendWord(R2_ID, *ptr--);              // r3
-  sendWord(R2_ID, *ptr--);              // r2
-  sendByte(R2_ID, (unsigned char )*ptr--);              // r1
-  sendByte(R2_ID, (unsigned char )*ptr);                // r0
-  ptr = reg + 4;
-  *ptr-- = receiveWord(R2_ID);          // r4
-  *ptr-- = receiveWord(R2_ID);          // r3
-  *ptr-- = receiveWord(R2_ID);          // r2
-  *ptr-- = receiveByte(R2_ID);          // r1
-  updateCarry(receiveByte(R2_ID) & 0x80, reg); // Cy
-  *ptr-- = receiveByte(R2_ID);          // r0
+  sendWordBlock(R2_ID, 3, reg + 2);                 // r4..r2
+  sendByte(R2_ID, (unsigned char )reg[1]);          // r1
+  sendByte(R2_ID, (unsigned char )reg[0]);          // r0
+  receiveWordBlock(R2_ID, 3, reg + 2);              // r4..r2
+  reg[1] = receiveByte(R2_ID);                      // r1
+  updateCarry(receiveByte(R2_ID) & 0x80, reg);      // Cy
+  reg[0] = receiveByte(R2_ID);                      // r0
 }
 
 static void tube_Find(unsigned int *reg) {
+  if (reg[0] == 0) {
+    // Write back any buffered bytes before the file is closed (handle 0 closes all files)
+    unsigned char handle = (unsigned char)reg[1];
+    sync_file_buffers(handle);
+    if (handle) {
+      file_unbuffered[handle >> 5] &= ~(1u << (handle & 31));
+      file_output[handle >> 5] &= ~(1u << (handle & 31));
+    } else {
+      memset(file_unbuffered, 0, sizeof(file_unbuffered));
+      memset(file_output, 0, sizeof(file_output));
+    }
+  }
   // OSFIND   R2: &12 &00 Y                         &7F
   // OSFIND   R2: &12 A string &0D                  A
   sendByte(R2_ID, 0x12);
@@ -1115,7 +1411,14 @@ static void tube_Find(unsigned int *reg) {
     // Send the 0x0D terminator
     sendByte(R2_ID, 0x0D);
     // Response is the file handle of file just opened
-    reg[0] = receiveByte(R2_ID);
+    unsigned char handle = receiveByte(R2_ID);
+    // Only files opened for output (&80) or update (&C0) get write-behind
+    if (reg[0] & 0x80) {
+      file_output[handle >> 5] |= 1u << (handle & 31);
+    } else {
+      file_output[handle >> 5] &= ~(1u << (handle & 31));
+    }
+    reg[0] = handle;
   }
 }
 
@@ -1149,6 +1452,10 @@ static void tube_GetEnv(unsigned int *reg) {
 }
 
 static void tube_Exit(unsigned int *reg) {
+  // Don't lose bytes written to files the program didn't close. Each buffer is
+  // released before it is written back, so if the host reports an error and
+  // the error handler exits again, the failed write isn't retried forever.
+  sync_file_buffers(0);
   unsigned int r12 = env->handler[EXIT_HANDLER].r12;
   EnvironmentHandler_type handler = env->handler[EXIT_HANDLER].handler;
   if (DEBUG_ARM) {
@@ -1293,20 +1600,18 @@ static void tube_ChangeEnvironment(unsigned int *reg) {
 }
 
 static void tube_Plot(unsigned int *reg) {
-    sendByte(R1_ID, 25);
-    sendByte(R1_ID, (unsigned char )(reg[0]) );
-    sendByte(R1_ID, (unsigned char )(reg[1]) );
-    sendByte(R1_ID, (unsigned char )(reg[1] >> 8) );
-    sendByte(R1_ID, (unsigned char )(reg[2]) );
-    sendByte(R1_ID, (unsigned char )(reg[2] >> 8) );
+    unsigned char plot[6];
+    plot[0] = 25;
+    plot[1] = (unsigned char )(reg[0]);
+    plot[2] = (unsigned char )(reg[1]);
+    plot[3] = (unsigned char )(reg[1] >> 8);
+    plot[4] = (unsigned char )(reg[2]);
+    plot[5] = (unsigned char )(reg[2] >> 8);
+    sendBytes(R1_ID, sizeof(plot), plot);
 }
 
 static void tube_WriteN(unsigned int *reg) {
-  unsigned char *ptr = (unsigned char *)reg[0];
-  unsigned int len = reg[1];
-  while (len-- > 0) {
-    sendByte(R1_ID, *ptr++);
-  }
+  sendBytes(R1_ID, reg[1], (unsigned char *)reg[0]);
 }
 
 static void tube_SynchroniseCodeAreas(unsigned int *reg) {
@@ -9,6 +9,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include "tube-defs.h"
 #include "tube.h"
@@ -18,6 +19,7 @@
 #include "rpi-interrupts.h"
 #include "cache.h"
 #include "info.h"
+#include "rpi-systimer.h"
 #include "performance.h"
 #include "framebuffer/framebuffer.h"
 
@@ -40,7 +42,9 @@
 // Another option if we go back to 8-bit values tube_regs is to use
 // CPG_Param0..CPG_Param1
 
+#ifndef TUBE_HEADLESS
 static void start_vc_ula();
+#endif
 
 #define GPU_TUBE_REG_ADDR 0x7e0000a0
 #define ARM_TUBE_REG_ADDR ((GPU_TUBE_REG_ADDR & 0x00FFFFFF) | PERIPHERAL_BASE)
@@ -49,10 +53,17 @@ static void start_vc_ula();
 #include "startup.h"
 
 int test_pin;
+
+#ifdef TUBE_HEADLESS
+// Headless builds (e.g. for the host test bench) keep the registers in memory
+static volatile uint32_t headless_tube_regs[8];
+static volatile uint32_t *tube_regs = headless_tube_regs;
+#else
 static uint32_t led_type=0;
 
 static volatile uint32_t *tube_regs = (uint32_t *) ARM_TUBE_REG_ADDR;
 static uint32_t host_addr_bus;
+#endif
 
 #define HBIT_7 ((uint32_t)(1 << 25))
 #define HBIT_6 ((uint32_t)(1 << 24))
@@ -69,11 +80,19 @@ static uint32_t host_addr_bus;
 static char copro_command =0;
 static perf_counters_t pct;
 
-static uint8_t ph1[24],ph3_1;
+// The R1 parasite to host FIFO holds 24 bytes, kept in a power of two ring
+// so the indices can run freely and just be masked. The byte at ph1rdpos is
+// also pre-loaded into PH1_0, and the FIFO holds ph1wrpos - ph1rdpos bytes.
+#define PH1_SIZE 24
+#define PH1_RING 32
+#define PH1_MASK (PH1_RING - 1)
+#define PH1_LEN ((uint8_t)(ph1wrpos - ph1rdpos))
+
+static uint8_t ph1[PH1_RING],ph3_1;
 static uint8_t hp1,hp2,hp3[2],hp4;
 static uint8_t pstat[4];
 static uint8_t ph3pos,hp3pos;
-static uint8_t ph1rdpos,ph1wrpos,ph1len;
+static uint8_t ph1rdpos,ph1wrpos;
 volatile int tube_irq;
 
 // Default value of the VDU property is 0 (off)
@@ -106,41 +125,122 @@ unsigned long int count_h = 0;
 unsigned long int count_p = 0;
 #endif
 
-#ifdef DEBUG_TUBE
-
-#define  TUBE_READ_MARKER 0x80000000
-#define TUBE_WRITE_MARKER 0x40000000
+// Tube traffic capture
+//
+// When enabled with tube_capture=<entries> in cmdline.txt, every access to a
+// data register (R1..R4) by the host or the parasite is recorded in a ring,
+// which is dumped over the UART on each tube reset, for decoding on a host
+// computer with tools/tube_analyser. Each entry is two words: the system timer
+// (in us) and the access, laid out as in the mailbox word:
+//   bit 12    -> parasite (rather than host) access
+//   bit 11    -> RnW
+//   10..8     -> A2..A0
+//   7..0      -> D7..D0
+
+#define CAPTURE_PARASITE (1 << 12)
+#define CAPTURE_READ     (1 << 11)
+
+#define CAPTURE_MAX_ENTRIES 0x100000
+
+static uint32_t *capture_buffer;
+static uint32_t capture_mask;   // entries - 1, or 0 when capture is disabled
+static uint32_t capture_index;
+
+static inline void tube_capture(uint32_t event) {
+   if (capture_mask) {
+      uint32_t *entry = capture_buffer + ((capture_index++ & capture_mask) << 1);
+      entry[0] = RPI_GetSystemTimer()->counter_lo;
+      entry[1] = event;
+   }
+}
 
-unsigned int tube_index;
-unsigned int tube_buffer[0x10000];
+#ifndef TUBE_HEADLESS
+static void tube_init_capture(uint32_t entries) {
+   if (entries > CAPTURE_MAX_ENTRIES) {
+      entries = CAPTURE_MAX_ENTRIES;
+   }
+   // Round down to a power of two
+   while (entries & (entries - 1)) {
+      entries &= entries - 1;
+   }
+   if (entries < 2) {
+      return;
+   }
+   capture_buffer = malloc(entries * 2 * sizeof(uint32_t));
+   if (capture_buffer) {
+      capture_index = 0;
+      capture_mask = entries - 1;
+      LOG_INFO("Tube capture of %"PRIu32" entries enabled\r\n", entries);
+   } else {
+      LOG_WARN("Tube capture: unable to allocate %"PRIu32" entries\r\n", entries);
+   }
+}
+#endif
 
-void tube_dump_buffer() {
-   int i;
-   LOG_INFO("tube_index = %u\r\n", tube_index);
-   for (i = 0; i < tube_index; i++) {
-      if (tube_buffer[i] & (TUBE_READ_MARKER | TUBE_WRITE_MARKER)) {
-         if (tube_buffer[i] & TUBE_READ_MARKER) {
-            LOG_INFO("Rd R");
-         }
-         if (tube_buffer[i] & TUBE_WRITE_MARKER) {
-            LOG_INFO("Wr R");
-         }
-         // Convert address (1,3,5,7) to R1,R2,R3,R4
-         LOG_INFO("%u = %02x\r\n", 1 + ((tube_buffer[i] & 0xF00) >> 9), tube_buffer[i] & 0xFF);
-      } else {
-         LOG_INFO("?? %08x\r\n", tube_buffer[i]);
-      }
+static void tube_dump_capture() {
+   // Only the most recent entries are still in the ring
+   uint32_t first = (capture_index > capture_mask) ? capture_index - capture_mask - 1 : 0;
+   LOG_INFO("Tube capture: %"PRIu32" of %"PRIu32" events\r\n", capture_index - first, capture_index);
+   for (uint32_t i = first; i != capture_index; i++) {
+      uint32_t *entry = capture_buffer + ((i & capture_mask) << 1);
+      LOG_INFO("TC %08"PRIx32" %04"PRIx32"\r\n", entry[0], entry[1]);
    }
+   capture_index = 0;
 }
 
-void tube_reset_buffer() {
-   int i;
-   tube_index = 0;
-   for (i = 0; i < 0x10000; i++) {
-      tube_buffer[i] = 0;
+// FIQ latency instrumentation
+//
+// With DEBUG_FIQ_LATENCY, each call of tube_io_handler is timed with the ARM
+// cycle counter, from entry (a few instructions after the FIQ is taken) to
+// exit, and the times accumulated into a histogram for each register and
+// access type. The handler must finish before the host's next access to the
+// tube, which can be as little as one 6502 bus cycle later. The cycle counter's
+// divide by 64 is turned off, so the buckets can be narrow enough for a small
+// regression to move the percentiles.
+
+#ifdef DEBUG_FIQ_LATENCY
+
+static tube_fiq_latency_t fiq_latency[FIQ_LATENCY_TYPES];
+
+// The cycle counter counts every processor cycle when DEBUG_FIQ_LATENCY is
+// defined (see performance.c)
+static inline uint32_t read_cycle_counter() {
+   uint32_t cycles;
+#if defined(RPI2) || defined(RPI3) || defined(RPI4)
+   asm volatile ("mrc p15,0,%0,c9,c13,0" : "=r" (cycles));
+#else
+   asm volatile ("mrc p15,0,%0,c15,c12,1" : "=r" (cycles));
+#endif
+   return cycles;
+}
+
+static inline void tube_record_fiq_latency(uint32_t mail, uint32_t entry) {
+   uint32_t cycles = read_cycle_counter() - entry;
+   uint32_t bucket = cycles / FIQ_LATENCY_BUCKET_CYCLES;
+   // Index by RnW and A2..A0
+   tube_fiq_latency_t *latency = fiq_latency + ((mail >> 8) & 0xF);
+   latency->count[bucket < FIQ_LATENCY_BUCKETS ? bucket : FIQ_LATENCY_BUCKETS - 1]++;
+   if (cycles > latency->max) {
+      latency->max = cycles;
    }
 }
+
+#endif
+
+int tube_get_fiq_latency(tube_fiq_latency_t *latency, int reset) {
+#ifdef DEBUG_FIQ_LATENCY
+   for (int i = 0; i < FIQ_LATENCY_TYPES; i++) {
+      latency[i] = fiq_latency[i];
+   }
+   if (reset) {
+      memset(fiq_latency, 0, sizeof(fiq_latency));
+   }
+   return 1;
+#else
+   return 0;
 #endif
+}
+
 /*
 static void tube_updateints_IRQ()
 {
@@ -211,6 +311,8 @@ static void copro_command_excute(unsigned char copro_comm,unsigned char val)
       copro = copro | 128 ;  // Set bit 7 to signal full reset of core
       break;
    case 3:
+      // The host doesn't poll, so this can't be deferred; instead the VDU
+      // queue keeps the space above its high-water mark for host characters
       if (vdu_enabled) {
          fb_writec_buffered(val);
       }
@@ -224,7 +326,7 @@ static void tube_reset()
 {
    tube_irq &= ~(RESET_BIT + NMI_BIT + IRQ_BIT);
    hp3pos = 0;
-   ph1rdpos = ph1wrpos = ph1len = 0;
+   ph1rdpos = ph1wrpos = 0;
    ph3pos = 1;
    PSTAT1 = 0x40;
    PSTAT2 = 0x7F;
@@ -258,18 +360,11 @@ static void tube_host_read(uint32_t addr)
    switch (addr & 7)
    {
    case 1: /*Register 1*/
-      if (ph1len > 0) {
-         PH1_0 = BYTE_TO_WORD(ph1[ph1rdpos]);
-           //for (c = 1; c < 23; c++) ph1[c] = ph1[c + 1];
-         ph1len--;
-         if ( ph1len != 0)
-         {
-            if (ph1rdpos== 23)
-               ph1rdpos =0;
-            else
-               ph1rdpos++;
-         }
-         if (!ph1len) HSTAT1 &= (uint32_t)~HBIT_7;
+      if (ph1wrpos != ph1rdpos) {
+         // Pre-load the next byte (which is stale if the FIFO is now empty)
+         ph1rdpos++;
+         PH1_0 = BYTE_TO_WORD(ph1[ph1rdpos & PH1_MASK]);
+         if (ph1wrpos == ph1rdpos) HSTAT1 &= (uint32_t)~HBIT_7;
          PSTAT1 |= 0x40;
       }
       // tube_updateints_IRQ(); // the above can't change the irq status
@@ -547,12 +642,9 @@ uint8_t tube_parasite_read(uint32_t addr)
       break;
    }
 
-#ifdef DEBUG_TUBE
    if (addr & 1) {
-      tube_buffer[tube_index++] = TUBE_READ_MARKER | ((addr & 7) << 8) | temp;
-      tube_index &= 0xffff;
+      tube_capture(CAPTURE_PARASITE | CAPTURE_READ | ((addr & 7) << 8) | temp);
    }
-#endif
    if ((cpsr & 0xc0) != 0xc0) {
       _set_interrupts(cpsr);
    }
@@ -586,35 +678,40 @@ void tube_parasite_write_banksel(uint32_t addr, uint8_t val)
   }
 }
 
+// Queues up to len bytes in the R1 parasite to host FIFO, returning the
+// number queued; any that don't fit are dropped, as by the real ULA
+static inline uint32_t ph1_write(const uint8_t *data, uint32_t len)
+{
+   uint32_t space = PH1_SIZE - PH1_LEN;
+   if (len > space) {
+      len = space;
+   }
+   if (len == 0) {
+      return 0;
+   }
+   if (ph1wrpos == ph1rdpos) {
+      PH1_0 = BYTE_TO_WORD(data[0]);
+   }
+   for (uint32_t i = 0; i < len; i++) {
+      ph1[(ph1wrpos + i) & PH1_MASK] = data[i];
+   }
+   ph1wrpos = (uint8_t)(ph1wrpos + len);
+   HSTAT1 |= HBIT_7;
+   if (PH1_LEN == PH1_SIZE) PSTAT1 &= (uint8_t)~0x40;
+   // tube_updateints_IRQ(); // the above can't change the IRQ flags
+   return len;
+}
+
 void tube_parasite_write(uint32_t addr, uint8_t val)
 {
    int cpsr = _disable_interrupts();
-#ifdef DEBUG_TUBE
    if (addr & 1) {
-      tube_buffer[tube_index++] = TUBE_WRITE_MARKER | ((addr & 7) << 8) | val;
-      tube_index &= 0xffff;
+      tube_capture(CAPTURE_PARASITE | ((addr & 7) << 8) | val);
    }
-#endif
    switch (addr & 7)
    {
    case 1: /*Register 1*/
-      if (ph1len < 24)
-      {
-         if (ph1len == 0) {
-            PH1_0 = BYTE_TO_WORD(val);
-         } else {
-            ph1[ph1wrpos] = val;
-            if (ph1wrpos== 23)
-               ph1wrpos =0;
-            else
-               ph1wrpos++;
-         }
-
-         ph1len++;
-         HSTAT1 |= HBIT_7;
-         if (ph1len == 24) PSTAT1 &= (uint8_t)~0x40;
-      }
-      // tube_updateints_IRQ(); // the above can't change the IRQ flags
+      ph1_write(&val, 1);
       break;
    case 3: /*Register 2*/
       PH2 = BYTE_TO_WORD(val);
@@ -669,12 +766,63 @@ void tube_parasite_write(uint32_t addr, uint8_t val)
    }
 }
 
+// Parasite side transfers for the ARM Native Co Pro's tube library: these
+// check the register status and move the data in a single critical section,
+// rather than one for the status read and another for the data access.
+// reg is 0..3 for R1..R4.
+
+// Returns 1 if the byte was sent, 0 if the register is full
+int tube_parasite_send(uint32_t reg, uint8_t val)
+{
+   int cpsr = _disable_interrupts();
+   int sent = (pstat[reg] & 0x40) != 0;
+   if (sent) {
+      tube_parasite_write((reg << 1) + 1, val);
+   }
+   if ((cpsr & 0xc0) != 0xc0) {
+      _set_interrupts(cpsr);
+   }
+   return sent;
+}
+
+// Returns the number of bytes queued in R1 (as many as there is space for),
+// filling several FIFO slots in a single critical section
+uint32_t tube_parasite_send_r1(const uint8_t *data, uint32_t len)
+{
+   int cpsr = _disable_interrupts();
+   uint32_t sent = ph1_write(data, len);
+   for (uint32_t i = 0; i < sent; i++) {
+      tube_capture(CAPTURE_PARASITE | (1 << 8) | data[i]);
+   }
+   if ((cpsr & 0xc0) != 0xc0) {
+      _set_interrupts(cpsr);
+   }
+   return sent;
+}
+
+// Returns 1 if a byte was received, 0 if the register is empty
+int tube_parasite_receive(uint32_t reg, uint8_t *val)
+{
+   int cpsr = _disable_interrupts();
+   int received = (pstat[reg] & 0x80) != 0;
+   if (received) {
+      *val = tube_parasite_read((reg << 1) + 1);
+   }
+   if ((cpsr & 0xc0) != 0xc0) {
+      _set_interrupts(cpsr);
+   }
+   return received;
+}
+
 // Returns bit 0 set if IRQ is asserted by the tube
 // Returns bit 1 set if NMI is asserted by the tube
 // Returns bit 2 set if RST is asserted by the host or tube
 
 int tube_io_handler(uint32_t mail)
 {
+#ifdef DEBUG_FIQ_LATENCY
+   uint32_t entry = read_cycle_counter();
+#endif
    // 23..16 -> D7..D0
    // 12     -> RST (active high)
    // 11     -> RnW
@@ -701,14 +849,53 @@ int tube_io_handler(uint32_t mail)
       unsigned int addr = (mail >> 8) & 7;
       // Check read write flag
       if (mail & (1 << 11)) {
+         // The host has just read the pre-loaded value, so latch it before
+         // the next one is pre-loaded, but record it afterwards to keep the
+         // capture off the critical path
+         uint32_t val = (capture_mask && (addr & 1)) ? WORD_TO_BYTE(tube_regs[addr]) : 0;
          tube_host_read(addr);
+         if (addr & 1) {
+            tube_capture((mail & 0xF00) | val);
+         }
       } else {
          tube_host_write(addr, (mail >> 16) & 0xFF);
+         if (addr & 1) {
+            tube_capture((mail & 0xF00) | ((mail >> 16) & 0xFF));
+         }
       }
    }
+#ifdef DEBUG_FIQ_LATENCY
+   tube_record_fiq_latency(mail, entry);
+#endif
    return tube_irq;
 }
 
+#ifdef TUBE_HEADLESS
+
+// There is no GPU or host, so just enable the tube and reset the registers
+
+void tube_init_hardware()
+{
+   tube_irq = TUBE_ENABLE_BIT;
+   hp1 = hp2 = hp4 = hp3[0]= hp3[1]=0;
+   tube_reset();
+}
+
+int tube_is_rst_active() {
+   return 0;
+}
+
+void tube_wait_for_rst_release() {
+   tube_reset();
+}
+
+// Returns the value a host read of addr would see, as the FIQ handler does
+uint8_t tube_host_peek(uint32_t addr) {
+   return (uint8_t)WORD_TO_BYTE(tube_regs[addr & 7]);
+}
+
+#else
+
 void tube_init_hardware()
 {
    uint32_t revision = get_revision();
@@ -846,6 +1033,12 @@ void tube_init_hardware()
       fb_initialize();
    }
 
+   // Read the tube capture property, which is the number of events to keep
+   char *capture_prop = get_cmdline_prop("tube_capture");
+   if (capture_prop) {
+      tube_init_capture((uint32_t)atoi(capture_prop));
+   }
+
    // Initialize performance counters
 #if defined(RPI2) || defined(RPI3) || defined(RPI4)
    pct.num_counters = 6;
@@ -868,6 +1061,10 @@ void tube_init_hardware()
    pct.counter[0] = 0;
    pct.counter[1] = 0;
 #endif
+#ifdef DEBUG_FIQ_LATENCY
+   // Start the cycle counter now, as not every Co Pro resets it
+   reset_performance_counters(&pct);
+#endif
 
    hp1 = hp2 = hp4 = hp3[0]= hp3[1]=0;
 
@@ -912,17 +1109,16 @@ void tube_wait_for_rst_release() {
    tube_reset();
 }
 
+#endif
+
 void tube_reset_performance_counters() {
    reset_performance_counters(&pct);
 }
 
 void tube_log_performance_counters() {
-#ifdef DEBUG_TUBE
-   // Dump tube buffer
-   tube_dump_buffer();
-   // Reset the tube buffer
-   tube_reset_buffer();
-#endif
+   if (capture_mask) {
+      tube_dump_capture();
+   }
 #ifdef DEBUG
    read_performance_counters(&pct);
    print_performance_counters(&pct);
@@ -946,6 +1142,8 @@ void disable_tube() {
    }
 }
 
+#ifndef TUBE_HEADLESS
+
 static void start_vc_ula()
 {
    unsigned int func,r0,r1, r2,r3,r4,r5;
@@ -997,3 +1195,5 @@ static void start_vc_ula()
 // }
 
 }
+
+#endif
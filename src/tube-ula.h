@@ -10,8 +10,21 @@
 // Uncomment to checksum tube transfers
 // #define DEBUG_TRANSFERS
 
-// Uncomment to log all tube FIFO reads/writes (excluding status only)
-// #define DEBUG_TUBE
+// Uncomment to time tube_io_handler with the ARM cycle counter (see *FIQLAT)
+// #define DEBUG_FIQ_LATENCY
+
+// Histogram buckets, each FIQ_LATENCY_BUCKET_CYCLES processor cycles wide;
+// the last bucket also counts anything longer
+#define FIQ_LATENCY_BUCKET_CYCLES 16
+#define FIQ_LATENCY_BUCKETS 64
+
+// One histogram for each of RnW and A2..A0
+#define FIQ_LATENCY_TYPES 16
+
+typedef struct {
+   uint32_t count[FIQ_LATENCY_BUCKETS];
+   uint32_t max;   // longest time, in processor cycles
+} tube_fiq_latency_t;
 
 extern int vdu_enabled;
 
@@ -29,6 +42,12 @@ extern void tube_parasite_write(uint32_t addr, uint8_t val);
 
 extern void tube_parasite_write_banksel(uint32_t addr, uint8_t val);
 
+extern int tube_parasite_send(uint32_t reg, uint8_t val);
+
+extern int tube_parasite_receive(uint32_t reg, uint8_t *val);
+
+extern uint32_t tube_parasite_send_r1(const uint8_t *data, uint32_t len);
+
 //extern void tube_reset();
 
 extern int tube_io_handler(uint32_t mail);
@@ -45,4 +64,11 @@ extern void tube_reset_performance_counters();
 
 extern void tube_log_performance_counters();
 
+// Copies FIQ_LATENCY_TYPES histograms, returning 0 if DEBUG_FIQ_LATENCY is off
+extern int tube_get_fiq_latency(tube_fiq_latency_t *latency, int reset);
+
+#ifdef TUBE_HEADLESS
+extern uint8_t tube_host_peek(uint32_t addr);
+#endif
+
 #endif
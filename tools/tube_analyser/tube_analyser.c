@@ -0,0 +1,395 @@
+// tube_analyser.c
+//
+// Host analyser for Tube traffic captures
+//
+// Reads a UART log containing a capture dumped by the Pi (enabled with
+// tube_capture=<entries> in cmdline.txt, and dumped on each tube reset),
+// decodes the data register accesses into Tube protocol messages, and reports
+// the latency of each type of OS call made by the parasite over R2, and the
+// throughput of the R3 data transfers set up by the host over R4.
+//
+// Usage: tube_analyser [ -v ] <uart log>
+//
+// With -v, each message is also listed as it is decoded.
+//
+// Capture lines have the form "TC <timestamp> <event>", where the timestamp is
+// the Pi system timer in us, and the event is laid out as:
+//   bit 12    -> parasite (rather than host) access
+//   bit 11    -> RnW
+//   10..8     -> A2..A0
+//   7..0      -> D7..D0
+// All other lines in the log are ignored.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define EV_PARASITE (1 << 12)
+#define EV_READ     (1 << 11)
+
+#define EV_REG(ev)  (((ev) >> 9) & 3)   // 0..3 for R1..R4
+#define EV_DATA(ev) ((ev) & 0xFF)
+
+static int verbose = 0;
+
+// ==========================================================================
+// R2 (parasite to host) OS calls
+// ==========================================================================
+
+// Request parameter lengths for each R2 command, after the command byte; -1
+// terminates a string with &0D, and -2 is the OSWORD block, whose length is
+// in the second byte of the request
+
+typedef struct {
+   const char *name;
+   int params[4];
+} r2_command_t;
+
+#define NUM_R2_COMMANDS 12
+
+static const r2_command_t r2_commands[NUM_R2_COMMANDS] = {
+   { "OSRDCH",  {  0            } },  // &00
+   { "OSCLI",   { -1            } },  // &02 string &0D
+   { "OSBYTELO",{  2            } },  // &04 X A
+   { "OSBYTEHI",{  3            } },  // &06 X Y A
+   { "OSWORD",  {  2, -2,  1    } },  // &08 A in_length block out_length
+   { "OSWORD0", {  5            } },  // &0A block
+   { "OSARGS",  {  6            } },  // &0C Y block A
+   { "OSBGET",  {  1            } },  // &0E Y
+   { "OSBPUT",  {  2            } },  // &10 Y A
+   { "OSFIND",  {  1            } },  // &12 A, then Y or string &0D
+   { "OSFILE",  { 16, -1,  1    } },  // &14 block string &0D A
+   { "OSGBPB",  { 14            } },  // &16 block A
+};
+
+typedef struct {
+   unsigned int count;
+   uint64_t total;
+   uint32_t min;
+   uint32_t max;
+} latency_t;
+
+static latency_t r2_latency[NUM_R2_COMMANDS];
+static unsigned int r2_unknown;
+
+// State of the R2 message being decoded
+static int r2_cmd = -1;        // index into r2_commands, or -1 when idle
+static int r2_field;           // index into params
+static int r2_left;            // bytes left in the current field (-1 for a string)
+static int r2_request_done;
+static uint32_t r2_start;      // time of the command byte
+static uint32_t r2_last;       // time of the last response byte
+static unsigned int r2_in_len; // OSWORD in_length
+
+static void add_latency(latency_t *l, uint32_t t) {
+   if (l->count == 0 || t < l->min) {
+      l->min = t;
+   }
+   if (t > l->max) {
+      l->max = t;
+   }
+   l->count++;
+   l->total += t;
+}
+
+static void r2_end() {
+   if (r2_cmd >= 0) {
+      uint32_t t = (r2_request_done ? r2_last : r2_start) - r2_start;
+      add_latency(r2_latency + r2_cmd, t);
+      if (verbose) {
+         printf("%08x %-8s %8u us\n", r2_start, r2_commands[r2_cmd].name, t);
+      }
+   }
+   r2_cmd = -1;
+}
+
+// Move on to the next field of the request, or to the response
+static void r2_next_field() {
+   while (1) {
+      if (r2_field >= 4 || (r2_field > 0 && r2_commands[r2_cmd].params[r2_field] == 0)) {
+         r2_request_done = 1;
+         return;
+      }
+      int len = r2_commands[r2_cmd].params[r2_field++];
+      if (len == -2) {
+         len = (int) r2_in_len;
+      }
+      if (len != 0) {
+         r2_left = len;
+         return;
+      }
+   }
+}
+
+static void r2_parasite_write(uint32_t time, uint8_t data) {
+   if (r2_cmd < 0 || r2_request_done) {
+      // A new command, which ends the previous one
+      r2_end();
+      if ((data & 1) || data / 2 >= NUM_R2_COMMANDS) {
+         r2_unknown++;
+         return;
+      }
+      r2_cmd = data / 2;
+      r2_start = time;
+      r2_last = time;
+      r2_field = 0;
+      r2_request_done = 0;
+      r2_next_field();
+      return;
+   }
+   if (r2_left == -1) {
+      // A string, terminated by &0D
+      if (data == 0x0D) {
+         r2_next_field();
+      }
+      return;
+   }
+   // OSWORD: the in_length is the second byte of the first field
+   if (r2_cmd == 4 && r2_field == 1 && r2_left == 1) {
+      r2_in_len = data;
+   }
+   // OSFIND: A=0 closes, and is followed by Y, otherwise by a filename
+   if (r2_cmd == 9 && r2_field == 1) {
+      r2_field = 4;
+      r2_left = 0;
+      if (data == 0) {
+         r2_left = 1;
+      } else {
+         r2_left = -1;
+      }
+      return;
+   }
+   if (--r2_left == 0) {
+      r2_next_field();
+   }
+}
+
+static void r2_parasite_read(uint32_t time) {
+   if (r2_cmd >= 0 && r2_request_done) {
+      r2_last = time;
+   }
+}
+
+// ==========================================================================
+// R4 (host to parasite) transfers
+// ==========================================================================
+
+typedef struct {
+   unsigned int count;
+   uint64_t bytes;
+   uint64_t time;
+} transfer_t;
+
+static transfer_t transfers[8];
+static unsigned int errors;
+
+typedef enum {
+   R4_IDLE,
+   R4_ID,
+   R4_ADDRESS,
+   R4_SYNC,
+   R4_DATA,
+   R4_ERROR
+} r4_state_t;
+
+static r4_state_t r4_state = R4_IDLE;
+static int r4_type;
+static int r4_left;
+static uint32_t r4_address;
+static uint32_t r3_first;
+static uint32_t r3_last;
+static unsigned int r3_bytes;
+
+static void r3_end() {
+   if (r4_state == R4_DATA) {
+      transfer_t *t = transfers + r4_type;
+      t->count++;
+      t->bytes += r3_bytes;
+      t->time += r3_bytes ? r3_last - r3_first : 0;
+      if (verbose) {
+         printf("%08x TYPE%d   %8u bytes to/from %08x in %u us\n",
+                r3_first, r4_type, r3_bytes, r4_address, r3_bytes ? r3_last - r3_first : 0);
+      }
+   }
+   r4_state = R4_IDLE;
+}
+
+static void r4_host_write(uint32_t time, uint8_t data) {
+   switch (r4_state) {
+   case R4_DATA:
+      r3_end();
+      // fall through
+   case R4_IDLE:
+      if (data == 0xFF) {
+         // An error, which is followed by R2 from the host
+         errors++;
+         if (verbose) {
+            printf("%08x ERROR\n", time);
+         }
+         // Any OS call in progress has been aborted
+         r2_end();
+         r4_state = R4_ERROR;
+      } else {
+         r4_type = data & 7;
+         r4_state = R4_ID;
+      }
+      break;
+   case R4_ID:
+      if (r4_type == 5) {
+         // Tube release has no address or sync byte
+         r4_state = R4_IDLE;
+      } else {
+         r4_address = 0;
+         r4_left = 4;
+         r4_state = R4_ADDRESS;
+      }
+      break;
+   case R4_ADDRESS:
+      r4_address = (r4_address << 8) | data;
+      if (--r4_left == 0) {
+         r4_state = R4_SYNC;
+      }
+      break;
+   case R4_SYNC:
+      r3_bytes = 0;
+      r3_first = r3_last = time;
+      r4_state = (r4_type == 4) ? R4_IDLE : R4_DATA;
+      break;
+   case R4_ERROR:
+      // Not expected, so resynchronise
+      r4_state = R4_IDLE;
+      break;
+   }
+}
+
+static void r3_host_access(uint32_t time) {
+   if (r4_state == R4_DATA) {
+      if (r3_bytes == 0) {
+         r3_first = time;
+      }
+      r3_last = time;
+      r3_bytes++;
+   }
+}
+
+// ==========================================================================
+// Main
+// ==========================================================================
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [ -v ] <uart log>\n", prog);
+   exit(1);
+}
+
+int main(int argc, char **argv) {
+   int opt;
+
+   while ((opt = getopt(argc, argv, "v")) != -1) {
+      switch (opt) {
+      case 'v':
+         verbose = 1;
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+   if (optind != argc - 1) {
+      usage(argv[0]);
+   }
+
+   FILE *f = fopen(argv[optind], "r");
+   if (!f) {
+      perror(argv[optind]);
+      return 1;
+   }
+
+   char line[256];
+   unsigned int events = 0;
+   unsigned int wrch = 0;
+   uint32_t first = 0;
+   uint32_t last = 0;
+
+   while (fgets(line, sizeof(line), f)) {
+      unsigned int time;
+      unsigned int ev;
+      char *tc = strstr(line, "TC ");
+      if (!tc || sscanf(tc, "TC %x %x", &time, &ev) != 2) {
+         continue;
+      }
+      if (events++ == 0) {
+         first = time;
+      }
+      last = time;
+      int parasite = (ev & EV_PARASITE) != 0;
+      int read = (ev & EV_READ) != 0;
+      switch (EV_REG(ev)) {
+      case 0:
+         // R1: parasite writes are OSWRCH
+         if (parasite && !read) {
+            wrch++;
+         }
+         break;
+      case 1:
+         // R2: OS calls from the parasite, and responses from the host
+         if (parasite) {
+            if (read) {
+               r2_parasite_read(time);
+            } else {
+               r2_parasite_write(time, (uint8_t) EV_DATA(ev));
+            }
+         } else if (!read && r4_state == R4_ERROR) {
+            // The error block follows, so resume looking for transfers
+            r4_state = R4_IDLE;
+         }
+         break;
+      case 2:
+         // R3: transfer data, counted at the host end
+         if (!parasite) {
+            r3_host_access(time);
+         }
+         break;
+      case 3:
+         // R4: transfer setup from the host
+         if (!parasite && !read) {
+            r4_host_write(time, (uint8_t) EV_DATA(ev));
+         }
+         break;
+      }
+   }
+   fclose(f);
+   r2_end();
+   r3_end();
+
+   if (events == 0) {
+      fprintf(stderr, "%s: no capture found\n", argv[optind]);
+      return 1;
+   }
+
+   printf("%u events over %u us\n", events, last - first);
+   printf("%u OSWRCH characters\n", wrch);
+   printf("\n%-8s %8s %10s %10s %10s %12s\n", "Call", "Count", "Min us", "Mean us", "Max us", "Total us");
+   for (int i = 0; i < NUM_R2_COMMANDS; i++) {
+      latency_t *l = r2_latency + i;
+      if (l->count) {
+         printf("%-8s %8u %10u %10.1f %10u %12llu\n", r2_commands[i].name, l->count, l->min,
+                (double) l->total / l->count, l->max, (unsigned long long) l->total);
+      }
+   }
+   if (r2_unknown) {
+      printf("%u unknown R2 commands\n", r2_unknown);
+   }
+   printf("\n%-8s %8s %12s %12s %12s\n", "Transfer", "Count", "Bytes", "Time us", "Bytes/s");
+   for (int i = 0; i < 8; i++) {
+      transfer_t *t = transfers + i;
+      if (t->count) {
+         printf("Type %d   %8u %12llu %12llu %12.0f\n", i, t->count, (unsigned long long) t->bytes,
+                (unsigned long long) t->time, t->time ? (double) t->bytes * 1e6 / (double) t->time : 0.0);
+      }
+   }
+   if (errors) {
+      printf("%u errors\n", errors);
+   }
+   return 0;
+}
@@ -0,0 +1,283 @@
+// tube_bench.c
+//
+// Host test bench for the Tube ULA model
+//
+// Drives tube-ula.c (built with TUBE_HEADLESS, so the registers the FIQ handler
+// reads are in memory) from a script of host and parasite accesses, encoding
+// the host accesses as the mailbox words the GPU sends, and checks the values
+// read and the interrupts raised along the way. With -r, the script is then
+// replayed the given number of times without the checks, and the cost of each
+// event reported.
+//
+// Usage: tube_bench [ -r <repeats> ] <script> ...
+//
+// Each line of a script is one of the following (values are hex, addresses
+// are 0..7 as &FEE0..&FEE7 on the host and the same offsets on the parasite):
+//
+//   reset                  reset the ULA, as on the release of RST
+//   hw   <addr> <val>      host write
+//   hr   <addr> [ <val> ]  host read, checking the value if given
+//   pw   <addr> <val>      parasite write
+//   pr   <addr> [ <val> ]  parasite read, checking the value if given
+//   mail <word>            pass a raw mailbox word to tube_io_handler
+//   irq  <0|1>             check the parasite IRQ
+//   nmi  <0|1>             check the parasite NMI
+//
+// Anything after a # is a comment.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "tube-defs.h"
+#include "tube.h"
+#include "tube-ula.h"
+#include "performance.h"
+
+// Mailbox word layout, see tube_io_handler
+#define MAIL_RNW      (1 << 11)
+#define MAIL(addr, val) ((((uint32_t)(val) & 0xFF) << 16) | (((uint32_t)(addr) & 7) << 8))
+
+#define MAX_OPS 0x10000
+
+// Stubs for the parts of the client used by tube-ula.c
+
+volatile unsigned int copro = 0;
+volatile unsigned int copro_speed = 0;
+volatile unsigned int copro_memory_size = 0;
+unsigned int arm_speed = 1000000000;
+
+int _disable_interrupts(void) {
+   return 0xC0;
+}
+
+void _enable_interrupts(void) {
+}
+
+void _set_interrupts(int cpsr) {
+}
+
+void map_4k_page(unsigned int logical, unsigned int physical) {
+}
+
+void reset_performance_counters(perf_counters_t *pct) {
+}
+
+void fb_writec(char c) {
+}
+
+void fb_writec_buffered(char c) {
+}
+
+int fb_get_cursor_x() {
+   return 0;
+}
+
+int fb_get_cursor_y() {
+   return 0;
+}
+
+int fb_get_cursor_char() {
+   return 0;
+}
+
+uint8_t fb_read_legacy_vdu_variable(uint8_t v) {
+   return 0;
+}
+
+// Script
+
+typedef enum {
+   OP_RESET,
+   OP_MAIL,
+   OP_PW,
+   OP_PR,
+   OP_IRQ,
+   OP_NMI
+} op_type_t;
+
+typedef struct {
+   op_type_t type;
+   uint32_t arg;    // mailbox word, address or expected state
+   int check;       // value to check on a read, or -1
+   int line;
+} op_t;
+
+static op_t ops[MAX_OPS];
+static int num_ops;
+
+static int parse_script(const char *filename) {
+   FILE *f = fopen(filename, "r");
+   if (!f) {
+      perror(filename);
+      return 1;
+   }
+   char buf[256];
+   int line = 0;
+   num_ops = 0;
+   while (fgets(buf, sizeof(buf), f)) {
+      line++;
+      char *comment = strchr(buf, '#');
+      if (comment) {
+         *comment = 0;
+      }
+      char cmd[16];
+      unsigned int a, b;
+      int n = sscanf(buf, "%15s %x %x", cmd, &a, &b);
+      if (n < 1) {
+         continue;
+      }
+      if (num_ops == MAX_OPS) {
+         fprintf(stderr, "%s:%d: too many operations\n", filename, line);
+         fclose(f);
+         return 1;
+      }
+      op_t *op = ops + num_ops;
+      op->line = line;
+      op->check = -1;
+      if (!strcmp(cmd, "reset") && n == 1) {
+         op->type = OP_RESET;
+      } else if (!strcmp(cmd, "hw") && n == 3) {
+         op->type = OP_MAIL;
+         op->arg = MAIL(a, b);
+      } else if (!strcmp(cmd, "hr") && n >= 2) {
+         op->type = OP_MAIL;
+         op->arg = MAIL(a, 0) | MAIL_RNW;
+         op->check = (n == 3) ? (int)(b & 0xFF) : -1;
+      } else if (!strcmp(cmd, "pw") && n == 3) {
+         op->type = OP_PW;
+         op->arg = a;
+         op->check = (int)(b & 0xFF);
+      } else if (!strcmp(cmd, "pr") && n >= 2) {
+         op->type = OP_PR;
+         op->arg = a;
+         op->check = (n == 3) ? (int)(b & 0xFF) : -1;
+      } else if (!strcmp(cmd, "mail") && n == 2) {
+         op->type = OP_MAIL;
+         op->arg = a;
+      } else if (!strcmp(cmd, "irq") && n == 2) {
+         op->type = OP_IRQ;
+         op->arg = a;
+      } else if (!strcmp(cmd, "nmi") && n == 2) {
+         op->type = OP_NMI;
+         op->arg = a;
+      } else {
+         fprintf(stderr, "%s:%d: syntax error\n", filename, line);
+         fclose(f);
+         return 1;
+      }
+      num_ops++;
+   }
+   fclose(f);
+   return 0;
+}
+
+// Run the script, returning the number of failed checks
+static int run_script(const char *filename, int check) {
+   int failures = 0;
+   for (int i = 0; i < num_ops; i++) {
+      op_t *op = ops + i;
+      int got = -1;
+      switch (op->type) {
+      case OP_RESET:
+         tube_wait_for_rst_release();
+         break;
+      case OP_MAIL:
+         if (op->arg & MAIL_RNW) {
+            // The host sees the value pre-loaded before the FIQ handler runs
+            got = tube_host_peek((op->arg >> 8) & 7);
+         }
+         tube_io_handler(op->arg);
+         break;
+      case OP_PW:
+         // The parasite write value is held in check
+         tube_parasite_write(op->arg, (uint8_t) op->check);
+         break;
+      case OP_PR:
+         got = tube_parasite_read(op->arg);
+         break;
+      case OP_IRQ:
+         got = (tube_irq & IRQ_BIT) ? 1 : 0;
+         break;
+      case OP_NMI:
+         got = (tube_irq & NMI_BIT) ? 1 : 0;
+         break;
+      }
+      if (!check) {
+         continue;
+      }
+      int expected = op->check;
+      if (op->type == OP_IRQ || op->type == OP_NMI) {
+         expected = (int) op->arg;
+      }
+      if (op->type != OP_PW && expected >= 0 && got != expected) {
+         fprintf(stderr, "%s:%d: expected %02x, got %02x\n", filename, op->line, expected, got);
+         failures++;
+      }
+   }
+   return failures;
+}
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [ -r <repeats> ] <script> ...\n", prog);
+   exit(1);
+}
+
+static double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+   int repeats = 0;
+   int opt;
+   int failed = 0;
+
+   while ((opt = getopt(argc, argv, "r:")) != -1) {
+      switch (opt) {
+      case 'r':
+         repeats = atoi(optarg);
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+   if (optind >= argc || repeats < 0) {
+      usage(argv[0]);
+   }
+
+   tube_init_hardware();
+
+   for (int s = optind; s < argc; s++) {
+      const char *filename = argv[s];
+      if (parse_script(filename)) {
+         return 1;
+      }
+      int failures = run_script(filename, 1);
+      printf("%s: %d operations, %d failures\n", filename, num_ops, failures);
+      if (failures) {
+         failed = 1;
+      }
+      if (repeats > 0) {
+         int events = 0;
+         for (int i = 0; i < num_ops; i++) {
+            if (ops[i].type == OP_MAIL || ops[i].type == OP_PW || ops[i].type == OP_PR) {
+               events++;
+            }
+         }
+         double start = now();
+         for (int r = 0; r < repeats; r++) {
+            run_script(filename, 0);
+         }
+         double elapsed = now() - start;
+         if (events > 0) {
+            printf("%s: %d events x %d in %.3f ms (%.1f ns/event)\n", filename, events, repeats,
+                   elapsed * 1e3, elapsed * 1e9 / ((double) events * repeats));
+         }
+      }
+   }
+   return failed;
+}
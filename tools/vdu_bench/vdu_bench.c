@@ -0,0 +1,177 @@
+// vdu_bench.c
+//
+// Host benchmark for the Pi VDU driver
+//
+// Drives the framebuffer code (built with FB_HEADLESS, so it renders to a
+// frame buffer in memory) from a recorded VDU byte stream, reports the
+// throughput, and optionally writes the final screen as a PPM image, so
+// rendering changes can be compared against golden images.
+//
+// Usage: vdu_bench [ -q | -n ] [ -m <mode> ] [ -r <repeats> ] [ -f <flashes> ] [ -o <file.ppm> ] <vdu stream>
+//
+// With -q, the stream is passed through the VDU queue, as characters from the
+// host are, rather than written directly. With -n, it is written in blocks
+// with fb_writen, as OS_WriteN and OS_Write0 are.
+//
+// With -f, the flashing colours of the final screen mode are then toggled the
+// given number of times, and the cost per toggle reported; this should not
+// depend on the size of the screen.
+//
+// The stream is the raw sequence of bytes sent to OSWRCH, e.g. captured
+// with *SPOOL, or written by a BASIC program using BPUT#.
+//
+// "make check" renders the streams in tests/ (text, graphics, mixed text and
+// graphics, and teletext) and compares them against golden images.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "framebuffer/framebuffer.h"
+#include "framebuffer/screen_modes.h"
+
+// Characters written to the VDU queue between drains with -q
+#define QUEUE_CHUNK 4096
+
+// Characters per fb_writen call with -n
+#define WRITEN_CHUNK 256
+
+// Stubs for the parts of the client used by the splash screen
+
+volatile unsigned int copro = 0;
+
+char *get_cmdline_prop(const char *prop) {
+   return getenv(prop);
+}
+
+char *get_copro_name(unsigned int i, unsigned int maxlen) {
+   return "Headless";
+}
+
+char *get_info_string() {
+   return "Host build\r\n";
+}
+
+static void usage(const char *prog) {
+   fprintf(stderr, "usage: %s [ -q | -n ] [ -m <mode> ] [ -r <repeats> ] [ -f <flashes> ] [ -o <file.ppm> ] <vdu stream>\n", prog);
+   exit(1);
+}
+
+static double now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+   int mode = -1;
+   int repeats = 1;
+   int flashes = 0;
+   int queued = 0;
+   int blocks = 0;
+   const char *ppm = NULL;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "qnm:r:f:o:")) != -1) {
+      switch (opt) {
+      case 'q':
+         queued = 1;
+         break;
+      case 'n':
+         blocks = 1;
+         break;
+      case 'm':
+         mode = atoi(optarg);
+         break;
+      case 'r':
+         repeats = atoi(optarg);
+         break;
+      case 'f':
+         flashes = atoi(optarg);
+         break;
+      case 'o':
+         ppm = optarg;
+         break;
+      default:
+         usage(argv[0]);
+      }
+   }
+   if (optind != argc - 1 || repeats < 1) {
+      usage(argv[0]);
+   }
+
+   // Load the VDU stream
+   FILE *f = fopen(argv[optind], "rb");
+   if (!f) {
+      perror(argv[optind]);
+      return 1;
+   }
+   fseek(f, 0, SEEK_END);
+   long len = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   char *stream = malloc(len > 0 ? (size_t) len : 1);
+   if (fread(stream, 1, (size_t) len, f) != (size_t) len) {
+      perror(argv[optind]);
+      return 1;
+   }
+   fclose(f);
+
+   fb_initialize();
+
+   double total = 0;
+   for (int i = 0; i < repeats; i++) {
+      // Each repeat starts from a freshly selected screen mode
+      if (mode >= 0) {
+         fb_writec(22);
+         fb_writec((char) mode);
+      }
+      double start = now();
+      for (long j = 0; j < len; j++) {
+         if (blocks) {
+            long n = (len - j < WRITEN_CHUNK) ? len - j : WRITEN_CHUNK;
+            fb_writen(stream + j, (unsigned int) n);
+            j += n - 1;
+         } else if (queued) {
+            fb_writec_buffered(stream[j]);
+            // Drain well before the queue fills, as the timer interrupt would
+            if ((j & (QUEUE_CHUNK - 1)) == QUEUE_CHUNK - 1) {
+               fb_process_vdu_queue();
+            }
+         } else {
+            fb_writec(stream[j]);
+         }
+      }
+      fb_process_vdu_queue();
+      total += now() - start;
+   }
+
+   printf("%ld bytes x %d in %.3f ms (%.0f bytes/s)\n",
+          len, repeats, total * 1e3, total > 0 ? (double) len * repeats / total : 0.0);
+
+   if (flashes > 0) {
+      screen_mode_t *screen = fb_get_current_screen_mode();
+      if (screen->flash) {
+         double start = now();
+         for (int i = 0; i < flashes; i++) {
+            screen->flash(screen, !(i & 1));
+         }
+         double elapsed = now() - start;
+         printf("%d flashes of %dx%d at %d bpp in %.3f ms (%.1f ns/flash)\n",
+                flashes, screen->width, screen->height, 1 << screen->log2bpp,
+                elapsed * 1e3, elapsed * 1e9 / flashes);
+      } else {
+         printf("No flashing colours in %d bpp modes\n", 1 << screen->log2bpp);
+      }
+   }
+
+   if (ppm && write_screen_ppm(fb_get_current_screen_mode(), ppm)) {
+      perror(ppm);
+      return 1;
+   }
+
+   fb_destroy();
+   free(stream);
+   return 0;
+}